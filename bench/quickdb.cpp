@@ -0,0 +1,155 @@
+// Compare loading rdeps.db as a std::map of std::sets (the old text format)
+// with the memory-mapped snapshot of quickdb.
+//
+// Usage: bench-quickdb [packages] [dependencies per package] [lookups]
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fmt/core.h>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <set>
+#include "minipkg2.hpp"
+#include "quickdb.hpp"
+#include "utils.hpp"
+
+using namespace minipkg2;
+
+// Resident set size in KiB.
+static long rss_kib() {
+    long size = 0, resident = 0;
+    if (std::FILE* file = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(file, "%ld %ld", &size, &resident) != 2)
+            resident = 0;
+        std::fclose(file);
+    }
+    return resident * (::sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+// The parser of the old text format ("key:value1,value2").
+static quickdb::quickdb read_text(const std::string& filename) {
+    quickdb::quickdb db{};
+    std::FILE* file = std::fopen(filename.c_str(), "r");
+    if (!file)
+        return db;
+
+    std::string line;
+    while (freadline(file, line)) {
+        const auto end_name = line.find(':');
+        auto& values = db[line.substr(0, end_name)];
+        std::size_t start = end_name + 1;
+        while (start < line.size()) {
+            const auto end = std::min(line.find(',', start), line.size());
+            values.emplace(line, start, end - start);
+            start = end + 1;
+        }
+    }
+    std::fclose(file);
+    return db;
+}
+
+// Run `func` in a child process, so that every variant starts with a fresh heap.
+// `func` stores the RSS while its data is still loaded.
+template<class Func>
+static void measure(const char* label, const Func& func) {
+    std::fflush(stdout);
+    const ::pid_t pid = ::fork();
+    if (pid == 0) {
+        const long rss_before = rss_kib();
+        const auto start = std::chrono::steady_clock::now();
+        long rss_after = 0;
+        const std::size_t found = func(rss_after);
+        const auto end = std::chrono::steady_clock::now();
+
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        fmt::print("{:<24} {:>10} us {:>10} KiB RSS {:>10} edges found\n", label, us, rss_after - rss_before, found);
+        std::exit(0);
+    }
+    xwait(pid);
+}
+
+int main(int argc, char* argv[]) {
+    const std::size_t num_packages  = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    const std::size_t num_deps      = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 8;
+    const std::size_t num_lookups   = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000;
+
+    char tmpdir[] = "/tmp/bench-quickdb.XXXXXX";
+    if (!::mkdtemp(tmpdir)) {
+        std::perror("mkdtemp()");
+        return 1;
+    }
+    dbdir = tmpdir;
+    const auto filename = dbdir + "/rdeps.db";
+
+    // Generate a database in the old text format.
+    // Note: The parent process must not allocate much, because its heap is inherited by the measurements.
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<std::size_t> dist{0, num_packages - 1};
+    std::FILE* file = std::fopen(filename.c_str(), "w");
+    for (std::size_t i = 0; i < num_packages; ++i) {
+        std::set<std::size_t> values{};
+        for (std::size_t j = 0; j < num_deps; ++j)
+            values.insert(dist(rng));
+
+        fmt::print(file, "package-{}:", i);
+        bool first = true;
+        for (const auto v : values) {
+            fmt::print(file, first ? "package-{}" : ",package-{}", v);
+            first = false;
+        }
+        fmt::print(file, "\n");
+    }
+    std::fclose(file);
+
+    std::vector<std::string> queries{};
+    for (std::size_t i = 0; i < num_lookups; ++i)
+        queries.push_back(fmt::format("package-{}", dist(rng)));
+
+    fmt::print("{} packages, {} dependencies each, {} lookups\n", num_packages, num_deps, num_lookups);
+
+    measure("std::map<std::set>", [&](long& rss) {
+        const auto db = read_text(filename);
+        std::size_t found = 0;
+        for (const auto& q : queries) {
+            const auto it = db.find(q);
+            if (it != db.end())
+                found += it->second.size();
+        }
+        rss = rss_kib();
+        return found;
+    });
+
+    // Convert the text file into a snapshot.
+    const ::pid_t pid = ::fork();
+    if (pid == 0)
+        std::exit(quickdb::compact("rdeps") ? 0 : 1);
+    if (xwait(pid) != 0)
+        return 1;
+
+    measure("mmap snapshot", [&](long& rss) {
+        std::size_t found = 0;
+        for (const auto& q : queries)
+            found += quickdb::lookup("rdeps", q).size();
+        rss = rss_kib();
+        return found;
+    });
+
+    measure("mmap snapshot, read()", [&](long& rss) {
+        const auto db = quickdb::read("rdeps");
+        std::size_t found = 0;
+        for (const auto& q : queries) {
+            const auto it = db.find(q);
+            if (it != db.end())
+                found += it->second.size();
+        }
+        rss = rss_kib();
+        return found;
+    });
+
+    rm(filename);
+    ::rmdir(tmpdir);
+    return 0;
+}
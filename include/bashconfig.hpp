@@ -18,6 +18,12 @@ namespace minipkg2::bashconfig {
     using config = std::map<std::string, value>;
 
     config read(std::FILE* file);
+
+    // Evaluate the top-level variable assignments of a package.build, without running bash.
+    // Only a static subset of bash is supported (assignments, arrays, quoting,
+    // $name/${name} expansions of variables defined earlier in the file and function definitions).
+    // Throws parse_error for anything that cannot be evaluated exactly.
+    config evaluate(std::FILE* file);
     void write(std::FILE* file, const config& conf);
     bool write_file(const std::string& filename, const config& conf);
 }
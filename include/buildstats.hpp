@@ -0,0 +1,33 @@
+#ifndef FILE_MINIPKG2_BUILDSTATS_HPP
+#define FILE_MINIPKG2_BUILDSTATS_HPP
+#include <string_view>
+#include <optional>
+#include <cstddef>
+
+// Durations of previous builds ($cachedir/build-stats).
+//
+// Each line of the file contains "<name> <version> <host> <wall> <cpu> <jobs>" (times in seconds, "-" is the native host).
+// New measurements are appended, the last line of a package wins.
+namespace minipkg2::buildstats {
+    struct entry {
+        double wall;
+        double cpu;
+        std::size_t jobs;   // The value of $JOBS (0 if unknown).
+    };
+
+    // Remember the duration of a build for the current host.
+    void record(std::string_view name, std::string_view version, const entry& e);
+
+    // Get the duration of the last build of exactly this version.
+    std::optional<entry> lookup(std::string_view name, std::string_view version);
+
+    // Predict the wall-clock time of a build: the last build of this version, or of any version,
+    // or the average of all known builds. Returns std::nullopt if nothing is known at all.
+    std::optional<double> estimate(std::string_view name, std::string_view version);
+
+    // Estimate how many jobs a package can keep busy, from the CPU time per wall-clock time of its last build.
+    // Returns std::nullopt if the package was never built, or if it used (nearly) all jobs it got.
+    std::optional<std::size_t> parallelism(std::string_view name, std::string_view version);
+}
+
+#endif /* FILE_MINIPKG2_BUILDSTATS_HPP */
@@ -65,14 +65,19 @@ namespace minipkg2::cmdline {
     namespace operations {
         extern operation* clean;
         extern operation* config;
+        extern operation* db;
         extern operation* download;
         extern operation* help;
         extern operation* install;
         extern operation* list;
+        extern operation* owns;
         extern operation* purge;
+        extern operation* rdeps;
         extern operation* remove;
         extern operation* repo;
         extern operation* show;
+        extern operation* upgrade;
+        extern operation* why;
     }
 
     int parse(int argc, char* argv[]);
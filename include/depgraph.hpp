@@ -0,0 +1,29 @@
+#ifndef FILE_MINIPKG2_DEPGRAPH_HPP
+#define FILE_MINIPKG2_DEPGRAPH_HPP
+#include <string_view>
+#include <string>
+#include <vector>
+#include "package.hpp"
+
+// Dependency graph of repository packages.
+namespace minipkg2::depgraph {
+    struct node {
+        source_package pkg;
+        std::vector<std::size_t> bdepends;  // Nodes that must be installed before this one is built.
+        std::vector<std::size_t> rdepends;  // Nodes that must be installed together with this one.
+    };
+
+    // The nodes are in installation order:
+    // The build-dependencies of a package come before, its runtime-dependencies after it.
+    struct graph {
+        std::vector<node> nodes;
+
+        std::vector<source_package> packages() &&;
+    };
+
+    // Load the packages `args` (and their dependencies) from the repo.
+    // Every package is parsed only once. Throws an exception that shows the path of a dependency cycle.
+    graph resolve(const std::vector<std::string>& args, bool resolve_deps, resolve_skip_policy policy);
+}
+
+#endif /* FILE_MINIPKG2_DEPGRAPH_HPP */
@@ -0,0 +1,44 @@
+#ifndef FILE_MINIPKG2_DOWNLOAD_HPP
+#define FILE_MINIPKG2_DOWNLOAD_HPP
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Concurrent downloads.
+//
+// All transfers are driven by one libcurl multi handle. DNS results, TLS sessions and connections
+// are shared between them, so that files from the same mirror don't need a new handshake each.
+// The number of concurrent transfers is limited by download.connections (in total)
+// and download.host-connections (per host) in the configuration.
+//
+// A file is downloaded into ".<name>.part" next to it and only renamed once it is complete.
+// A failed transfer is retried (download.retries) and continues where it stopped (HTTP Range).
+// The ETag and Last-Modified headers are stored in ".<name>.part.validators" before the first byte of the part,
+// so that even a part left behind by a killed process is only resumed if the file on the server didn't change (If-Range).
+// A part without validators is only resumed if the checksum of the file is known.
+// Once the file is complete, they are renamed to ".<name>.validators",
+// to ask the server whether an existing file is still up to date.
+//
+// Files are hashed (SHA-256) while they are received and added to the source cache (sourcecache.hpp).
+// A transfer with a known checksum is served from the cache without any network access.
+namespace minipkg2 {
+    enum class download_policy {
+        DEFAULT,        // REVALIDATE if download.revalidate is enabled, otherwise MISSING.
+        MISSING,        // Only download files that don't exist yet.
+        REVALIDATE,     // Also download existing files again, if they changed on the server.
+        ALWAYS,         // Download all files again.
+    };
+
+    struct transfer {
+        std::string url;
+        std::string dest;
+        std::string sha256{};   // The expected checksum (optional).
+        std::string error{};    // Set if the transfer failed.
+    };
+
+    // Download all transfers, a failed transfer doesn't affect the others.
+    // Returns the number of failed transfers.
+    std::size_t download(std::vector<transfer>& transfers, download_policy policy = download_policy::DEFAULT);
+}
+
+#endif /* FILE_MINIPKG2_DOWNLOAD_HPP */
@@ -0,0 +1,38 @@
+#ifndef FILE_MINIPKG2_FILEINDEX_HPP
+#define FILE_MINIPKG2_FILEINDEX_HPP
+#include <string_view>
+#include <utility>
+#include <string>
+#include <vector>
+
+// Index of the files owned by installed packages ($dbdir/files.idx).
+//
+// The index is a memory-mapped table of (path, package) pairs sorted by path.
+// Directories are not tracked, because they are shared between packages.
+// If the index doesn't exist, it is rebuilt from the installed packages.
+// While a quickdb::transaction is open, changes are kept in memory and merged into the index once by commit().
+namespace minipkg2::fileindex {
+    // Convert a path into the form that is stored in the index ("/usr/bin/foo").
+    std::string normalize(std::string_view path);
+
+    // Fix a path from a list of files written by older versions, that lost its first character ("sr/bin/foo" -> "/usr/bin/foo").
+    // The lost character is found among the top-level entries of the root. Other paths are returned as they are.
+    std::string repair_legacy(std::string_view path);
+
+    // Get the packages that own `path`.
+    std::vector<std::string> owners(std::string_view path);
+
+    // Get the files of `files` that are owned by another package than `name`, together with their owner.
+    std::vector<std::pair<std::string, std::string>> collisions(std::string_view name, std::vector<std::string> files);
+
+    // Replace the files of package `name` (an empty list removes the package).
+    bool update(const std::string& name, const std::vector<std::string>& files);
+
+    // Merge the changes made during a transaction into the index.
+    bool flush();
+
+    // Recreate the index from the installed packages.
+    bool rebuild();
+}
+
+#endif /* FILE_MINIPKG2_FILEINDEX_HPP */
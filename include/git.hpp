@@ -1,16 +1,30 @@
 #ifndef FILE_MINIPKG2_GIT_HPP
 #define FILE_MINIPKG2_GIT_HPP
+#include <string_view>
+#include <optional>
+#include <cstddef>
 #include <string>
+#include <vector>
 
 namespace minipkg2::git {
     // Get the version of git.
     std::string version();
 
     // Clone a git repository.
-    bool clone(const std::string& url, const std::string& dest, const std::string& branch);
+    // depth != 0 only fetches the last `depth` commits of every branch (--depth),
+    // a non-empty `filter` makes a partial clone, that fetches missing objects on demand (--filter, e.g. "blob:none").
+    bool clone(const std::string& url, const std::string& dest, const std::string& branch,
+               std::size_t depth = 0, const std::string& filter = {});
 
-    // Synchronize a local git repository.
-    bool pull(const std::string& repo);
+    // A file changed by fast_forward().
+    struct change {
+        char status;        // 'A'dded, 'M'odified or 'D'eleted.
+        std::string path;   // Relative to the repository.
+    };
+
+    // Fetch the upstream branch and fast-forward to it (never merges).
+    // Returns std::nullopt if that failed, e.g. because the local branch has diverged.
+    std::optional<std::vector<change>> fast_forward(const std::string& repo);
 
     // Switch to a different branch.
     bool checkout(const std::string& repo, const std::string& branch);
@@ -18,8 +32,25 @@ namespace minipkg2::git {
     // Get the current branch.
     std::string branch(const std::string& repo);
 
-    // If the repo already exists, git_pull(dest), otherwise git_clone(url, dest, NULL);
-    bool sync(const std::string& url, const std::string& dest);
+    // A git source of a package: "git://host/repo.git" or "git+<url>",
+    // optionally followed by "#branch=<name>" and/or "#depth=<n>" (separated by '&').
+    struct source {
+        std::string url;
+        std::string branch{};
+        std::size_t depth = 0;      // Only fetch the last `depth` commits (0: the whole history).
+    };
+
+    // Returns std::nullopt if `src` isn't a git source.
+    std::optional<source> parse_source(std::string_view src);
+
+    // Get the bare mirror of `url` in $cachedir/git.
+    std::string mirror_path(std::string_view url);
+
+    // Create the mirror of a source with `git clone --mirror`, or update it with `git fetch`.
+    bool update_mirror(const source& src);
+
+    // Replace `dest` with a clone of the mirror, that shares its objects (git clone --shared).
+    bool checkout_source(const source& src, const std::string& dest);
 }
 
 #endif /* FILE_MINIPKG2_GIT_HPP */
@@ -0,0 +1,32 @@
+#ifndef FILE_MINIPKG2_JOBSERVER_HPP
+#define FILE_MINIPKG2_JOBSERVER_HPP
+#include <spawn.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// GNU make jobserver, shared by all packages that are built at once.
+//
+// Every running build implicitly owns one job, additional jobs are tokens in a pipe,
+// which is passed to the builds by MAKEFLAGS="-j --jobserver-auth=R,W".
+namespace minipkg2::jobserver {
+    // Holds the implicit job of a build for the lifetime of the object.
+    struct slot {
+        slot();
+        slot(const slot&) = delete;
+        ~slot();
+    };
+
+    // Create the token pipe for `jobs` concurrent jobs, when up to `slots` builds run at once.
+    void start(std::size_t jobs, std::size_t slots);
+
+    // Destroy the token pipe and print how well the jobs were utilized.
+    void stop();
+
+    bool active();
+
+    // Pass the jobserver to a child process (MAKEFLAGS and the pipe).
+    void inherit(std::vector<char*>& env, posix_spawn_file_actions_t& actions);
+}
+
+#endif /* FILE_MINIPKG2_JOBSERVER_HPP */
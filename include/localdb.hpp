@@ -0,0 +1,52 @@
+#ifndef FILE_MINIPKG2_LOCALDB_HPP
+#define FILE_MINIPKG2_LOCALDB_HPP
+#include <string_view>
+#include <optional>
+#include <string>
+#include <vector>
+#include "bashconfig.hpp"
+
+// Single-file database of installed packages ($dbdir/local.db).
+//
+// If this file exists, it replaces the per-package directories in $pkgdir.
+// It holds the package.info and the list of files of every installed package,
+// and a hash table of all package names, provided names and dependencies,
+// that maps them to their package and to their reverse-dependencies.
+// While a quickdb::transaction is open, put() and erase() only change a copy in memory,
+// that is written once when the transaction is committed.
+namespace minipkg2::localdb {
+    // Is the single-file database in use?
+    bool enabled();
+
+    // Find the installed package that is or provides `name`.
+    std::optional<std::string> resolve(std::string_view name);
+
+    // Get the package.info of an installed package.
+    std::optional<std::string> info(std::string_view name);
+
+    // Get the files of an installed package.
+    std::vector<std::string> files(std::string_view name);
+
+    // Get the installed packages that depend on `name`.
+    std::vector<std::string> rdeps(std::string_view name);
+
+    // Get the names of all installed packages.
+    std::vector<std::string> packages();
+
+    // Add or replace a package.
+    void put(const std::string& name, const bashconfig::config& info, const std::vector<std::string>& files);
+
+    // Remove a package.
+    void erase(const std::string& name);
+
+    // Write the changes made during a transaction.
+    bool flush();
+
+    // Convert $pkgdir into $dbdir/local.db.
+    bool migrate();
+
+    // Convert $dbdir/local.db back into $pkgdir.
+    bool export_files();
+}
+
+#endif /* FILE_MINIPKG2_LOCALDB_HPP */
@@ -2,6 +2,7 @@
 #define FILE_MINIPKG2_MINIPKG2_HPP
 #include <string_view>
 #include <string>
+#include <vector>
 #include "miniconf.hpp"
 
 #ifndef VERSION
@@ -47,6 +48,9 @@ namespace minipkg2 {
     void set_root(std::string_view);
     bool init_self();
     void print_version();
+
+    // Add the variables env.bash expects (ROOT, ENV_FILE, MINIPKG2, MINIPKG2_CONFIG_FD).
+    void add_script_environ(std::vector<char*>& env);
 }
 
 #endif /* FILE_MINIPKG2_MINIPKG2_HPP */
@@ -0,0 +1,17 @@
+#ifndef FILE_MINIPKG2_ORPHANS_HPP
+#define FILE_MINIPKG2_ORPHANS_HPP
+#include <string>
+#include <vector>
+
+// Find installed packages that are no longer needed.
+//
+// Every package that can be reached from an explicitly installed package,
+// through the runtime-dependencies (and the packages providing them), is marked;
+// the remaining packages are orphans.
+namespace minipkg2::orphans {
+    // Get the orphans that would remain after `removed` is removed, in alphabetical order.
+    // If `removed` isn't empty, only its (transitive) dependencies and `removed` itself are considered.
+    std::vector<std::string> sweep(const std::vector<std::string>& removed = {});
+}
+
+#endif /* FILE_MINIPKG2_ORPHANS_HPP */
@@ -13,6 +13,7 @@
 #include <set>
 #include <map>
 #include "bashconfig.hpp"
+#include "download.hpp"
 
 namespace minipkg2 {
     struct package_base;
@@ -27,6 +28,11 @@ namespace minipkg2 {
         ALWAYS,     // Always skip installed packages.
     };
 
+    enum class install_reason {
+        EXPLICIT,   // Installed on request of the user.
+        DEPENDENCY, // Only installed as a dependency of another package.
+    };
+
     struct package_base {
         std::string filename;
         std::string name;
@@ -53,17 +59,21 @@ namespace minipkg2 {
     };
     struct source_package : package_base {
         std::vector<std::string> sources;
+        std::vector<std::string> sha256sums;    // Empty, or one per source ("SKIP" to not check a source).
         std::vector<std::string> bdepends;
         std::vector<std::string> features;
 
         void print() const override;
         bool download() const;
-        std::optional<binary_package> build(std::string_view path_binpkg, const std::string& filesdir) const;
+        std::optional<binary_package> build(std::string_view path_binpkg, const std::string& filesdir, bool quiet = false, std::size_t num_jobs = 0) const;
 
-        static bool                             download(const std::vector<source_package>&);
+        static bool                             download(const std::vector<source_package>&, download_policy policy = download_policy::DEFAULT);
+        static std::vector<bool>                download(const std::vector<const source_package*>&, download_policy policy = download_policy::DEFAULT);
         static std::optional<source_package>    parse_file(const std::string& filename);
         static std::optional<source_package>    parse_repo(std::string_view name);
         static std::set<source_package>         parse_repo();
+        static std::set<source_package>         parse_repo(const std::vector<std::string>& names);
+        static bool                             verify_native_parser();
         static std::vector<source_package>      resolve(const std::vector<std::string>& args, bool resolve_deps, resolve_skip_policy policy);
         static std::vector<install_transaction> resolve_conflicts(const std::vector<source_package>& pkgs, bool strict = false);
     };
@@ -90,19 +100,21 @@ namespace minipkg2 {
         std::string path;
         binary_package_info pkg;
 
-        bool install() const;
+        // If `is_explicit` isn't set, an update keeps the old install reason.
+        bool install(bool force = false, bool is_explicit = true) const;
 
         static std::optional<binary_package> load(std::string path);
     };
 
     struct installed_package : binary_package_info {
         std::time_t install_date;
+        install_reason reason = install_reason::EXPLICIT;
 
         installed_package() = default;
         installed_package(const installed_package&) = default;
         installed_package(installed_package&&) = default;
-        installed_package(const binary_package_info& base, std::time_t install_date)
-            : binary_package_info(base), install_date(install_date) {}
+        installed_package(const binary_package_info& base, std::time_t install_date, install_reason reason = install_reason::EXPLICIT)
+            : binary_package_info(base), install_date(install_date), reason(reason) {}
 
         ~installed_package() override = default;
 
@@ -115,6 +127,7 @@ namespace minipkg2 {
         static std::optional<installed_package> parse_file(const std::string& filename);
         static std::optional<installed_package> parse_local(std::string_view name);
         static std::set<installed_package>      parse_local();
+        static std::set<installed_package>      parse_local(const std::vector<std::string>& names);
         static std::list<std::string>           get_files(std::string_view name);
         static std::vector<installed_package>   resolve(const std::vector<std::string>& args);
         static std::size_t                      estimate_size(std::string_view name);
@@ -0,0 +1,37 @@
+#ifndef FILE_MINIPKG2_PARSER_HPP
+#define FILE_MINIPKG2_PARSER_HPP
+#include <sys/types.h>
+#include <optional>
+#include <string>
+#include <cstdio>
+
+// Evaluation of package files with parse.bash.
+//
+// By default, packages are evaluated by a pool of long-lived `parse.bash --server` processes,
+// that source env.bash only once (see parse.server in minipkg2.conf).
+namespace minipkg2::parser {
+    struct server;
+
+    // A package that is being evaluated, either by its own instance of parse.bash or by a server.
+    struct job {
+        std::string filename;
+        ::pid_t pid = -1;
+        std::FILE* file = nullptr;
+        server* srv = nullptr;
+        int err = -1;           // Stderr of its own instance of parse.bash, printed by finish().
+
+        bool running() const noexcept { return pid != -1 || srv != nullptr; }
+    };
+
+    // Start parsing a package file.
+    job start(const std::string& filename);
+
+    // Wait for the job to finish, print what it wrote to stderr and return the record printed by parse.bash.
+    // Note: Jobs must be finished in the order they were started.
+    std::optional<std::string> finish(job& j);
+
+    // How many jobs may run at the same time (-j, or the number of CPUs).
+    std::size_t concurrency();
+}
+
+#endif /* FILE_MINIPKG2_PARSER_HPP */
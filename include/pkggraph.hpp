@@ -0,0 +1,55 @@
+#ifndef FILE_MINIPKG2_PKGGRAPH_HPP
+#define FILE_MINIPKG2_PKGGRAPH_HPP
+#include <unordered_map>
+#include <string_view>
+#include <optional>
+#include <utility>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Dependency graph of the installed packages.
+//
+// The graph is loaded once per process and stored as adjacency arrays (CSR):
+// the dependencies of package i are deps[dep_offsets[i] .. dep_offsets[i+1]),
+// its reverse-dependencies are rdeps[rdep_offsets[i] .. rdep_offsets[i+1]).
+namespace minipkg2::pkggraph {
+    using node = std::uint32_t;
+
+    struct graph {
+        std::vector<std::string> names;             // Sorted by name.
+        std::vector<bool> is_explicit;
+        std::vector<node> dep_offsets, deps;
+        std::vector<node> rdep_offsets, rdeps;
+        std::unordered_map<std::string, node> providers;     // Names and provided names.
+
+        std::size_t size() const noexcept { return names.size(); }
+
+        // Find the package that is or provides `name`.
+        std::optional<node> find(std::string_view name) const;
+
+        std::pair<const node*, const node*> dependencies(node n) const noexcept {
+            return { deps.data() + dep_offsets[n], deps.data() + dep_offsets[n + 1] };
+        }
+        std::pair<const node*, const node*> dependents(node n) const noexcept {
+            return { rdeps.data() + rdep_offsets[n], rdeps.data() + rdep_offsets[n + 1] };
+        }
+    };
+
+    // Get the graph of the installed packages.
+    const graph& load();
+
+    // Find the shortest chain of dependencies from an explicitly installed package to `target`.
+    // The result starts with the explicit package and ends with `target` (empty if there is none).
+    std::vector<node> why(const graph& g, node target);
+
+    // Get the packages that depend on `targets` (directly, or also indirectly if `transitive` is set),
+    // in breadth-first order, together with the package through which they were reached.
+    std::vector<std::pair<node, node>> reverse_dependencies(const graph& g, const std::vector<node>& targets, bool transitive);
+
+    // Print edges (dependent, dependency) in the DOT format. Explicitly installed packages are drawn bold.
+    void write_dot(std::FILE* file, const graph& g, const std::vector<std::pair<node, node>>& edges);
+}
+
+#endif /* FILE_MINIPKG2_PKGGRAPH_HPP */
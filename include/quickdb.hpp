@@ -1,18 +1,49 @@
 #ifndef FILE_MINIPKG2_QUICKDB_HPP
 #define FILE_MINIPKG2_QUICKDB_HPP
+#include <string_view>
 #include <string>
+#include <vector>
 #include <set>
 #include <map>
 
+// Small key -> set databases in $dbdir (conflicts, rdeps).
+//
+// The database is stored as a memory-mapped snapshot of interned names and adjacency arrays.
+// Modifications are appended to a journal, that is merged into the database from time to time.
+// While a transaction is open, modifications are only kept in memory and written all at once by commit().
 namespace minipkg2::quickdb {
     using quickdb = std::map<std::string, std::set<std::string>>;
 
+    // Batch all modifications until commit() or the end of the scope.
+    struct transaction {
+        transaction();
+        transaction(const transaction&) = delete;
+        ~transaction();
+
+        bool commit();
+    private:
+        bool active = true;
+    };
+
+    // Is a transaction open?
+    bool in_transaction();
+
+    // Queries that use the memory-mapped database directly.
+    // The returned views are only valid until the database is modified.
+    bool                            contains(std::string_view dbname, std::string_view key);
+    std::vector<std::string_view>   lookup(std::string_view dbname, std::string_view key);
+    std::vector<std::string>        keys_containing(std::string_view dbname, std::string_view value);
+
+    // Copy the whole database into a map.
     quickdb read(std::string_view name);
     void write(std::string_view name, const quickdb& db);
 
     void set(std::string_view dbname, const std::string& name, const std::set<std::string>& value);
     void set(std::string_view dbname, const std::string& name, std::set<std::string>&& value);
     void remove(std::string_view dbname, const std::string& name);
+
+    // Merge the journal into the database.
+    bool compact(std::string_view name);
 }
 
 #endif /* FILE_MINIPKG2_QUICKDB_HPP */
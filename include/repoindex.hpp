@@ -0,0 +1,49 @@
+#ifndef FILE_MINIPKG2_REPOINDEX_HPP
+#define FILE_MINIPKG2_REPOINDEX_HPP
+#include <string_view>
+#include <optional>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <set>
+
+// Persistent cache of parsed repo packages ($dbdir/repo.idx).
+//
+// Each entry stores the record printed by parse.bash for one package,
+// keyed by the mtime/size of its package.build and the mtime of its files/ directory.
+// The file is memory-mapped, entries are sorted by name and looked up with a binary search.
+namespace minipkg2::repoindex {
+    struct stamp {
+        std::int64_t build_mtime;
+        std::uint64_t build_size;
+        std::int64_t files_mtime;
+
+        bool operator==(const stamp& other) const noexcept {
+            return build_mtime == other.build_mtime
+                && build_size  == other.build_size
+                && files_mtime == other.files_mtime;
+        }
+        bool operator!=(const stamp& other) const noexcept { return !(*this == other); }
+    };
+
+    // Get the current stamp of $repodir/<name>.
+    std::optional<stamp> make_stamp(std::string_view name);
+
+    // Get the cached record of a package, if it is up-to-date.
+    // Note: The returned view is valid until the next call to save().
+    std::optional<std::string_view> lookup(std::string_view name, const stamp& st);
+
+    // Add or replace the record of a package.
+    void store(std::string_view name, const stamp& st, std::string record);
+
+    // Remove the given packages, e.g. because `repo --sync` changed them.
+    void invalidate(const std::vector<std::string>& names);
+
+    // Remove all packages that are not in `names`.
+    void retain(const std::set<std::string>& names);
+
+    // Write the index back to disk, if it was modified.
+    bool save();
+}
+
+#endif /* FILE_MINIPKG2_REPOINDEX_HPP */
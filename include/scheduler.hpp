@@ -0,0 +1,54 @@
+#ifndef FILE_MINIPKG2_SCHEDULER_HPP
+#define FILE_MINIPKG2_SCHEDULER_HPP
+#include <functional>
+#include <cstddef>
+#include <vector>
+
+// Runs the builds of a set of packages concurrently, in the order of their dependencies.
+namespace minipkg2::scheduler {
+    struct task {
+        std::vector<std::size_t> waits;     // Tasks that must be finished before this one may start.
+    };
+
+    struct options {
+        std::size_t slots = 1;              // How many tasks may run at once.
+        bool keep_going = false;            // Continue with independent tasks after a failure.
+        std::vector<double> priority{};     // Ready tasks with a higher priority are started first (optional).
+        std::size_t jobs = 0;               // Jobs shared by the running tasks (0: don't divide jobs).
+        std::vector<std::size_t> parallelism{}; // How many jobs each task can use (optional, 0: any number).
+        std::size_t prefetch = 1;           // How many fetched tasks may wait to be started (with `fetch`).
+    };
+
+    struct interval {
+        double start;
+        double end;
+    };
+
+    // Run `build(i, jobs)` for every task in a worker thread, as soon as all its `waits` are finished,
+    // then `finish(i)` in the calling thread. Tasks are started in the order of their priority, then index.
+    // The tasks that are started at once get a share of the jobs, that are not used by running tasks.
+    // A task gets at most opts.jobs / opts.slots jobs, unless it can use more (opts.parallelism)
+    // and no other task is about to be started, or it is among the last tasks.
+    // If `fetch` is set, it runs in a background thread and gets the tasks in a topological order,
+    // but at most opts.prefetch tasks ahead of the started ones. All tasks that fit into this window are passed at once,
+    // the window is refilled as tasks are started. `fetch` returns the success of each task.
+    // A task is only started once it was fetched.
+    // If either of them fails, the dependent tasks are skipped. Without keep_going, no new tasks are started.
+    // Returns true if all tasks were finished.
+    bool run(const std::vector<task>& tasks, const options& opts,
+             const std::function<std::vector<bool>(const std::vector<std::size_t>&)>& fetch,
+             const std::function<bool(std::size_t, std::size_t)>& build,
+             const std::function<bool(std::size_t)>& finish);
+
+    // Get the length of the longest path from each task to the end of the schedule (including the task itself).
+    std::vector<double> critical_path(const std::vector<task>& tasks, const std::vector<double>& durations);
+
+    // Divide `budget` jobs between tasks that can use `wanted[k]` jobs each (0: any number),
+    // so that no task gets more than it can use. Every task gets at least 1 job.
+    std::vector<std::size_t> divide(const std::vector<std::size_t>& wanted, std::size_t budget);
+
+    // Predict when each task would run, if it takes `durations[i]`.
+    std::vector<interval> simulate(const std::vector<task>& tasks, const options& opts, const std::vector<double>& durations);
+}
+
+#endif /* FILE_MINIPKG2_SCHEDULER_HPP */
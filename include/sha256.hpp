@@ -0,0 +1,35 @@
+#ifndef FILE_MINIPKG2_SHA256_HPP
+#define FILE_MINIPKG2_SHA256_HPP
+#include <string_view>
+#include <optional>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// SHA-256 (FIPS 180-4), used to verify downloaded sources.
+namespace minipkg2::sha256 {
+    // Incremental hash, data can be added as it arrives.
+    struct context {
+        context();
+        void update(const void* data, std::size_t size);
+
+        // Finish the hash and get it as 64 lowercase hex digits.
+        std::string hex_digest();
+
+    private:
+        void transform(const unsigned char* block);
+
+        std::uint32_t state[8];
+        std::uint64_t length;
+        unsigned char buffer[64];
+        std::size_t buffered;
+    };
+
+    // Hash a whole file, returns std::nullopt if it cannot be read.
+    std::optional<std::string> file(const std::string& filename);
+
+    // Is `str` a hash as returned by hex_digest()?
+    bool is_valid(std::string_view str);
+}
+
+#endif /* FILE_MINIPKG2_SHA256_HPP */
@@ -0,0 +1,28 @@
+#ifndef FILE_MINIPKG2_SOURCECACHE_HPP
+#define FILE_MINIPKG2_SOURCECACHE_HPP
+#include <string_view>
+#include <string>
+
+// Content-addressed store of downloaded sources ($cachedir/sources/<xx>/<sha256>).
+//
+// Sources are reflinked into $S (or hardlinked/copied, if that isn't possible),
+// so different versions that ship the same file share one download, which survives `minipkg2 clean`.
+// A stamp next to each checked out file records its size and mtime, so it isn't checked out again.
+namespace minipkg2::sourcecache {
+    // Get the path of a file in the store.
+    std::string path(std::string_view sha256);
+
+    bool contains(std::string_view sha256);
+
+    // Is `dest` unchanged since it was checked out or added?
+    bool is_checked_out(std::string_view sha256, const std::string& dest);
+
+    // Replace `dest` with the file from the store, after verifying it.
+    // A corrupted file is removed from the store.
+    bool checkout(std::string_view sha256, const std::string& dest);
+
+    // Add a downloaded file to the store, if it isn't in it yet.
+    bool add(const std::string& file, std::string_view sha256);
+}
+
+#endif /* FILE_MINIPKG2_SOURCECACHE_HPP */
@@ -0,0 +1,23 @@
+#ifndef FILE_MINIPKG2_UPGRADE_HPP
+#define FILE_MINIPKG2_UPGRADE_HPP
+#include <string>
+#include <vector>
+
+// Find installed packages that need to be rebuilt.
+namespace minipkg2::upgrade {
+    struct candidate {
+        std::string name;
+        std::string installed_version;
+        std::string repo_version;
+    };
+
+    // Get the installed packages that have a newer version in the repo, sorted by name.
+    // If `names` is not empty, only these packages are checked.
+    std::vector<candidate> find_upgradable(const std::vector<std::string>& names = {});
+
+    // Get the installed packages that (transitively) depend on `names`, but aren't in `names`.
+    // Only packages that are still in the repo are returned.
+    std::vector<std::string> reverse_dependencies(const std::vector<std::string>& names);
+}
+
+#endif /* FILE_MINIPKG2_UPGRADE_HPP */
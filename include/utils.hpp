@@ -1,9 +1,11 @@
 #ifndef FILE_MINIPKG2_UTILS_HPP
 #define FILE_MINIPKG2_UTILS_HPP
 #include <fmt/format.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <string_view>
 #include <algorithm>
+#include <atomic>
 #include <utility>
 #include <string>
 #include <vector>
@@ -12,6 +14,9 @@
 #include <list>
 
 namespace minipkg2 {
+    // Number of child processes spawned by this process.
+    extern std::atomic<std::size_t> spawn_count;
+
     std::string xreadlink(const std::string& filename);
     std::pair<int, std::string> xpread(const std::string& cmd);
     bool freadline(FILE* file, std::string& line);
@@ -19,6 +24,8 @@ namespace minipkg2 {
     std::time_t str_to_uts(const std::string&);
     char* xstrdup(std::string_view);
     int xwait(pid_t pid);
+    int xwait(pid_t pid, struct ::rusage& usage);
+    int xsystem(const std::string& cmd);
     std::string fmt_size(std::size_t);
 
     std::vector<char*> copy_environ();
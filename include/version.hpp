@@ -0,0 +1,21 @@
+#ifndef FILE_MINIPKG2_VERSION_HPP
+#define FILE_MINIPKG2_VERSION_HPP
+#include <string_view>
+#include <string>
+
+// Comparison of package versions.
+//
+// A version is split into numeric and alphabetic segments, anything else separates them.
+// Numbers are compared by value and letters alphabetically (ignoring case).
+// "alpha", "beta", "pre" and "rc" mark a pre-release, "git", "svn", "hg" and "bzr" a snapshot after the release,
+// and any other letters a patch level after the release:
+//   1.0alpha < 1.0rc1 < 1.0 < 1.0-git < 1.0-git20240101 < 1.0a < 1.0p1 < 1.0.1
+namespace minipkg2::version {
+    // Get a key that compares like the version with a plain string comparison.
+    std::string make_key(std::string_view version);
+
+    // Returns <0, 0 or >0, if `a` is older, equal or newer than `b`.
+    int compare(std::string_view a, std::string_view b);
+}
+
+#endif /* FILE_MINIPKG2_VERSION_HPP */
@@ -1,3 +1,5 @@
+#include <functional>
+#include <optional>
 #include <cctype>
 #include "bashconfig.hpp"
 #include "utils.hpp"
@@ -17,7 +19,7 @@ namespace minipkg2::bashconfig {
         config conf{};
         std::size_t lineNum = 0;
         std::function<int()> next;
-        next = [file, &lineNum, next] {
+        next = [file, &lineNum, &next] {
             int ch = std::fgetc(file);
             if (ch == '\n') {
                 ++lineNum;
@@ -105,6 +107,518 @@ namespace minipkg2::bashconfig {
         }
         return conf;
     }
+
+    // Evaluator used by evaluate().
+    struct evaluator {
+        std::string src;
+        std::size_t pos = 0;
+        std::size_t lineNum = 1;
+        config vars{};
+
+        int peek(std::size_t off = 0) const noexcept {
+            return pos + off < src.size() ? static_cast<unsigned char>(src[pos + off]) : EOF;
+        }
+        int get() noexcept {
+            const int ch = peek();
+            if (ch != EOF)
+                ++pos;
+            if (ch == '\n')
+                ++lineNum;
+            return ch;
+        }
+        [[noreturn]]
+        void unsupported(std::string_view what) const {
+            raise<parse_error>("{}: Unsupported: {}.", lineNum, what);
+        }
+        static bool isblank(int ch) noexcept {
+            return ch == ' ' || ch == '\t';
+        }
+        // Characters that may directly precede a comment.
+        static bool isbreak(int ch) noexcept {
+            return std::isspace(ch) || ch == ';' || ch == '&' || ch == '|' || ch == '(' || ch == ')';
+        }
+
+        void skip_comment() {
+            while (peek() != '\n' && peek() != EOF)
+                get();
+        }
+        // Skip whitespace, line continuations and (optionally) newlines, ';' and comments.
+        void skip_space(bool newlines) {
+            while (true) {
+                const int ch = peek();
+                if (isblank(ch)) {
+                    get();
+                } else if (ch == '\\' && peek(1) == '\n') {
+                    get();
+                    get();
+                } else if (newlines && (ch == '\n' || ch == ';')) {
+                    get();
+                } else if (newlines && ch == '#') {
+                    skip_comment();
+                } else {
+                    break;
+                }
+            }
+        }
+        bool at_end_of_command() const noexcept {
+            const int ch = peek();
+            return ch == EOF || ch == '\n' || ch == ';' || ch == '#';
+        }
+        std::string read_name() {
+            std::string name{};
+            while (isname(peek()))
+                name += static_cast<char>(get());
+            return name;
+        }
+
+        // Values of variables.
+        const value& lookup(const std::string& name) const {
+            const auto it = vars.find(name);
+            if (it == vars.end())
+                unsupported("reference to '" + name + "', which is not defined by the package");
+            return it->second;
+        }
+        static std::string first(const value& val) {
+            if (const auto* str = std::get_if<std::string>(&val))
+                return *str;
+            const auto& vec = std::get<std::vector<std::string>>(val);
+            return vec.empty() ? std::string{} : vec.front();
+        }
+        static std::vector<std::string> elements(const value& val) {
+            if (const auto* str = std::get_if<std::string>(&val))
+                return { *str };
+            return std::get<std::vector<std::string>>(val);
+        }
+
+        // Parse an expansion after the '$'.
+        // Returns std::nullopt for a literal '$', and sets `array` to the name for ${name[@]}.
+        std::optional<std::string> expansion(std::optional<std::string>& array) {
+            array.reset();
+            const int ch = peek();
+            if (ch == '{') {
+                get();
+                if (!isname1(peek()))
+                    unsupported("parameter expansion");
+                const auto name = read_name();
+                std::optional<std::size_t> index{};
+                if (peek() == '[') {
+                    get();
+                    if ((peek() == '@' || peek() == '*') && peek(1) == ']') {
+                        array = name;
+                        get();
+                        get();
+                    } else {
+                        std::string num{};
+                        while (std::isdigit(peek()))
+                            num += static_cast<char>(get());
+                        if (num.empty() || get() != ']')
+                            unsupported("array subscript");
+                        index = std::stoul(num);
+                    }
+                }
+                if (get() != '}')
+                    unsupported("parameter expansion");
+
+                const auto& val = lookup(name);
+                if (array.has_value())
+                    return std::string{};
+                if (index.has_value()) {
+                    const auto vec = elements(val);
+                    return index.value() < vec.size() ? vec[index.value()] : std::string{};
+                }
+                return first(val);
+            } else if (isname1(ch)) {
+                return first(lookup(read_name()));
+            } else if (ch == '(' || ch == '\'' || ch == '"' || ch == '@' || ch == '*' || ch == '#'
+                       || ch == '?' || ch == '-' || ch == '$' || ch == '!' || std::isdigit(ch)) {
+                unsupported("special expansion");
+            }
+            return {};
+        }
+
+        // Parse one word of an assignment.
+        // In arrays, the word may expand to zero or more fields.
+        std::vector<std::string> word(bool in_array) {
+            std::string str{};
+            bool quoted = false;
+            bool has_literal = false;
+            std::optional<std::vector<std::string>> splice{};
+            std::size_t parts = 0;
+
+            const auto unquoted_expansion = [&](const std::string& val) {
+                if (!in_array)
+                    return;
+                for (const char ch : val) {
+                    if (std::isspace(static_cast<unsigned char>(ch)) || ch == '*' || ch == '?' || ch == '[')
+                        unsupported("word splitting or pathname expansion");
+                }
+            };
+            const auto add_splice = [&](const value& val, bool check) {
+                auto vec = elements(val);
+                if (check) {
+                    for (const auto& e : vec)
+                        unquoted_expansion(e);
+                    vec.erase(std::remove(begin(vec), end(vec), std::string{}), end(vec));
+                }
+                splice = std::move(vec);
+            };
+
+            while (true) {
+                const int ch = peek();
+                if (ch == EOF || std::isspace(ch) || ch == ';') {
+                    break;
+                } else if (ch == ')') {
+                    if (!in_array)
+                        unsupported("')'");
+                    break;
+                } else if (ch == '&' || ch == '|' || ch == '<' || ch == '>' || ch == '(' || ch == '`') {
+                    unsupported(fmt::format("'{}'", static_cast<char>(ch)));
+                } else if (ch == '\\') {
+                    get();
+                    const int next = get();
+                    if (next == EOF)
+                        raise<parse_error>("{}: Unexpected end of file.", lineNum);
+                    if (next != '\n') {
+                        str += static_cast<char>(next);
+                        has_literal = true;
+                    }
+                } else if (ch == '\'') {
+                    get();
+                    int c;
+                    while ((c = get()) != '\'') {
+                        if (c == EOF)
+                            raise<parse_error>("{}: Unexpected end of file.", lineNum);
+                        str += static_cast<char>(c);
+                    }
+                    quoted = true;
+                    ++parts;
+                } else if (ch == '"') {
+                    get();
+                    quoted = true;
+                    ++parts;
+                    while (true) {
+                        int c = get();
+                        if (c == EOF) {
+                            raise<parse_error>("{}: Unexpected end of file.", lineNum);
+                        } else if (c == '"') {
+                            break;
+                        } else if (c == '\\') {
+                            const int next = get();
+                            if (next == '$' || next == '`' || next == '"' || next == '\\') {
+                                str += static_cast<char>(next);
+                            } else if (next != '\n') {
+                                str += '\\';
+                                str += static_cast<char>(next);
+                            }
+                        } else if (c == '`') {
+                            unsupported("command substitution");
+                        } else if (c == '$') {
+                            std::optional<std::string> array;
+                            const auto val = expansion(array);
+                            if (array.has_value()) {
+                                if (!in_array || peek() != '"' || parts != 1 || !str.empty())
+                                    unsupported("\"${name[@]}\" inside of a word");
+                                add_splice(lookup(array.value()), false);
+                            } else if (val.has_value()) {
+                                str += val.value();
+                            } else {
+                                str += '$';
+                            }
+                        } else {
+                            str += static_cast<char>(c);
+                        }
+                    }
+                } else if (ch == '$') {
+                    get();
+                    std::optional<std::string> array;
+                    const auto val = expansion(array);
+                    ++parts;
+                    if (array.has_value()) {
+                        if (!in_array || parts != 1 || !str.empty())
+                            unsupported("${name[@]} inside of a word");
+                        add_splice(lookup(array.value()), true);
+                    } else if (val.has_value()) {
+                        unquoted_expansion(val.value());
+                        str += val.value();
+                    } else {
+                        str += '$';
+                        has_literal = true;
+                    }
+                } else if (ch == '~' && (str.empty() || str.back() == ':')) {
+                    unsupported("tilde expansion");
+                } else if (in_array && (ch == '*' || ch == '?' || ch == '[' || ch == '{')) {
+                    unsupported("pathname or brace expansion");
+                } else {
+                    str += static_cast<char>(get());
+                    has_literal = true;
+                }
+
+                if (splice.has_value() && (peek() != EOF && !std::isspace(peek()) && peek() != ')' && peek() != ';'))
+                    unsupported("${name[@]} inside of a word");
+            }
+
+            if (splice.has_value())
+                return std::move(splice.value());
+            // Unquoted expansions that are empty vanish.
+            if (in_array && str.empty() && !quoted && !has_literal)
+                return {};
+            return { str };
+        }
+
+        void assignment(const std::string& name) {
+            if (name == "IFS")
+                unsupported("assignment to IFS");
+
+            bool append = false;
+            if (peek() == '+') {
+                get();
+                append = true;
+            }
+            get(); // '='
+
+            value val;
+            if (peek() == '(') {
+                get();
+                std::vector<std::string> vec{};
+                while (true) {
+                    skip_space(false);
+                    const int ch = peek();
+                    if (ch == ')') {
+                        get();
+                        break;
+                    } else if (ch == EOF) {
+                        raise<parse_error>("{}: Unexpected end of file.", lineNum);
+                    } else if (ch == '\n') {
+                        get();
+                    } else if (ch == '#') {
+                        skip_comment();
+                    } else if (ch == ';') {
+                        unsupported("';' in an array");
+                    } else {
+                        const auto fields = word(true);
+                        vec.insert(end(vec), begin(fields), end(fields));
+                    }
+                }
+                if (!at_end_of_command() && !isblank(peek()))
+                    unsupported("garbage after an array");
+                if (append) {
+                    if (auto it = vars.find(name); it != vars.end()) {
+                        auto old = elements(it->second);
+                        old.insert(end(old), begin(vec), end(vec));
+                        vec = std::move(old);
+                    }
+                }
+                val = std::move(vec);
+            } else {
+                auto str = word(false).front();
+                if (auto it = vars.find(name); it != vars.end()) {
+                    // Bash only replaces element 0 of an array.
+                    if (!std::holds_alternative<std::string>(it->second))
+                        unsupported(append ? "appending a string to an array" : "assigning a string to an array");
+                    if (append)
+                        str = std::get<std::string>(it->second) + str;
+                }
+                val = std::move(str);
+            }
+            vars[name] = std::move(val);
+        }
+
+        // Skip the body of a function definition.
+        void skip_parens() {
+            // After '$(' or '('.
+            std::size_t depth = 1;
+            while (depth != 0) {
+                const int ch = get();
+                switch (ch) {
+                case EOF:
+                    raise<parse_error>("{}: Unexpected end of file.", lineNum);
+                case '\\':
+                    get();
+                    break;
+                case '\'':
+                    skip_quote('\'');
+                    break;
+                case '"':
+                    skip_dquote();
+                    break;
+                case '(':
+                    ++depth;
+                    break;
+                case ')':
+                    --depth;
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        void skip_quote(int end) {
+            int ch;
+            while ((ch = get()) != end) {
+                if (ch == EOF)
+                    raise<parse_error>("{}: Unexpected end of file.", lineNum);
+                if (ch == '\\' && end != '\'')
+                    get();
+            }
+        }
+        void skip_dquote() {
+            while (true) {
+                const int ch = get();
+                if (ch == EOF) {
+                    raise<parse_error>("{}: Unexpected end of file.", lineNum);
+                } else if (ch == '"') {
+                    return;
+                } else if (ch == '\\') {
+                    get();
+                } else if (ch == '`') {
+                    skip_quote('`');
+                } else if (ch == '$' && peek() == '(') {
+                    get();
+                    skip_parens();
+                }
+            }
+        }
+        void function_body() {
+            skip_space(true);
+            if (get() != '{')
+                unsupported("function body that is not a '{ ... }' group");
+
+            std::size_t depth = 1;
+            int prev = '{';
+            while (true) {
+                const int ch = get();
+                switch (ch) {
+                case EOF:
+                    raise<parse_error>("{}: Unexpected end of file.", lineNum);
+                case '\\':
+                    get();
+                    break;
+                case '\'':
+                    skip_quote('\'');
+                    break;
+                case '"':
+                    skip_dquote();
+                    break;
+                case '`':
+                    skip_quote('`');
+                    break;
+                case '$':
+                    if (peek() == '\'') {
+                        get();
+                        skip_quote('\'');
+                    } else if (peek() == '(') {
+                        get();
+                        skip_parens();
+                    } else if (peek() == '{') {
+                        // ${...} is balanced on its own.
+                        get();
+                        skip_quote('}');
+                    }
+                    break;
+                case '#':
+                    if (isbreak(prev))
+                        skip_comment();
+                    break;
+                case '<':
+                    if (peek() == '<' && peek(1) != '<')
+                        unsupported("here-document");
+                    break;
+                case '{':
+                    ++depth;
+                    break;
+                case '}':
+                    if (--depth == 0) {
+                        // The closing brace must be a command on its own.
+                        std::size_t i = pos - 1;
+                        while (i > 0 && isblank(src[i - 1]))
+                            --i;
+                        const char before = i > 0 ? src[i - 1] : '\n';
+                        if (before != '\n' && before != ';' && before != '&' && before != '{')
+                            unsupported("unbalanced braces in a function");
+                        return;
+                    }
+                    break;
+                default:
+                    break;
+                }
+                prev = ch;
+            }
+        }
+        bool function_parens() {
+            skip_space(false);
+            if (peek() != '(')
+                return false;
+            get();
+            skip_space(false);
+            if (get() != ')')
+                unsupported("subshell");
+            return true;
+        }
+
+        void command() {
+            const auto start = pos;
+            std::string word{};
+            while (peek() != EOF && !std::isspace(peek()) && peek() != '(' && peek() != ')'
+                   && peek() != ';' && peek() != '=' && peek() != '+' && peek() != '\'' && peek() != '"'
+                   && peek() != '$' && peek() != '\\' && peek() != '`') {
+                word += static_cast<char>(get());
+            }
+
+            if (word == "function") {
+                skip_space(false);
+                std::string fname{};
+                while (peek() != EOF && !std::isspace(peek()) && peek() != '(')
+                    fname += static_cast<char>(get());
+                if (fname.empty())
+                    unsupported("function definition");
+                function_parens();
+                function_body();
+                return;
+            }
+
+            // Assignments.
+            if (!word.empty() && (peek() == '=' || (peek() == '+' && peek(1) == '='))) {
+                pos = start;
+                while (true) {
+                    const auto name = read_name();
+                    if (name.empty() || !(peek() == '=' || (peek() == '+' && peek(1) == '=')))
+                        unsupported("command");
+                    assignment(name);
+                    skip_space(false);
+                    if (at_end_of_command())
+                        return;
+                }
+            }
+
+            // Function definitions.
+            if (!word.empty() && function_parens()) {
+                function_body();
+                return;
+            }
+
+            unsupported(word.empty() ? std::string{"command"} : "command '" + word + "'");
+        }
+
+        config run() {
+            while (true) {
+                skip_space(true);
+                if (peek() == EOF)
+                    break;
+                command();
+            }
+            return std::move(vars);
+        }
+    };
+
+    config evaluate(std::FILE* file) {
+        evaluator eval{};
+        char buffer[512];
+        std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof buffer, file)) != 0)
+            eval.src.append(buffer, n);
+        return eval.run();
+    }
+
     void write(std::FILE* file, const config& conf) {
         const auto check_name = [](const std::string& name) {
             if (name.empty() || !isname1(name.front()))
@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <mutex>
+#include <map>
+#include "buildstats.hpp"
+#include "minipkg2.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::buildstats {
+    struct package_stats {
+        std::map<std::string, entry, std::less<>> versions{};
+        std::string last;       // The most recently built version.
+    };
+
+    // Builds record their durations concurrently.
+    static std::mutex mtx;
+    static bool loaded = false;
+    static std::map<std::string, package_stats, std::less<>> stats{};
+    static std::vector<std::string> other_hosts{};      // Lines of other hosts are kept as they are.
+
+    static std::string stats_filename() {
+        return cachedir + "/build-stats";
+    }
+
+    // Builds for the native host (no --host) are stored as "-".
+    static std::string_view host_name() {
+        return host.empty() ? "-" : std::string_view{host};
+    }
+
+    static void put(const std::string& name, const std::string& version, const entry& e) {
+        auto& pkg = stats[name];
+        pkg.versions[version] = e;
+        pkg.last = version;
+    }
+
+    // Rewrite the file with only the last line of every package version.
+    static void compact() {
+        const auto filename = stats_filename();
+        const auto tmpname = filename + ".tmp";
+        std::FILE* file = std::fopen(tmpname.c_str(), "w");
+        if (!file)
+            return;
+
+        for (const auto& line : other_hosts)
+            fmt::print(file, "{}\n", line);
+        for (const auto& [name, pkg] : stats) {
+            // The last built version must be written last.
+            for (const auto& [version, e] : pkg.versions) {
+                if (version != pkg.last)
+                    fmt::print(file, "{} {} {} {:.3f} {:.3f} {}\n", name, version, host_name(), e.wall, e.cpu, e.jobs);
+            }
+            const auto& e = pkg.versions.at(pkg.last);
+            fmt::print(file, "{} {} {} {:.3f} {:.3f} {}\n", name, pkg.last, host_name(), e.wall, e.cpu, e.jobs);
+        }
+
+        if (std::fclose(file) != 0 || std::rename(tmpname.c_str(), filename.c_str()) != 0)
+            rm(tmpname);
+    }
+
+    static void load() {
+        if (loaded)
+            return;
+        loaded = true;
+
+        const auto filename = stats_filename();
+        std::FILE* file = std::fopen(filename.c_str(), "r");
+        if (!file)
+            return;
+
+        std::size_t num_lines = 0, num_entries = 0;
+        char name[256], version[256], line_host[256];
+        entry e;
+        std::string line{};
+        while (freadline(file, line)) {
+            ++num_lines;
+            // The number of jobs is missing in old files.
+            e.jobs = 0;
+            if (std::sscanf(line.c_str(), "%255s %255s %255s %lf %lf %zu", name, version, line_host, &e.wall, &e.cpu, &e.jobs) < 5) {
+                printerr(color::DEBUG, "{}: Ignoring invalid line {}.", filename, num_lines);
+                continue;
+            }
+            if (host_name() == line_host) {
+                put(name, version, e);
+            } else {
+                other_hosts.push_back(line);
+            }
+        }
+        std::fclose(file);
+
+        for (const auto& [_, pkg] : stats)
+            num_entries += pkg.versions.size();
+        num_entries += other_hosts.size();
+        if (num_lines > 2 * num_entries + 64)
+            compact();
+    }
+
+    void record(std::string_view name, std::string_view version, const entry& e) {
+        std::lock_guard lock{mtx};
+        load();
+        put(std::string{name}, std::string{version}, e);
+
+        mkdir_p(cachedir);
+        std::FILE* file = std::fopen(stats_filename().c_str(), "a");
+        if (!file) {
+            printerr(color::WARN, "Failed to open '{}'.", stats_filename());
+            return;
+        }
+        fmt::print(file, "{} {} {} {:.3f} {:.3f} {}\n", name, version, host_name(), e.wall, e.cpu, e.jobs);
+        std::fclose(file);
+    }
+
+    std::optional<entry> lookup(std::string_view name, std::string_view version) {
+        std::lock_guard lock{mtx};
+        load();
+        const auto pkg = stats.find(name);
+        if (pkg == stats.end())
+            return {};
+        const auto it = pkg->second.versions.find(version);
+        if (it == pkg->second.versions.end())
+            return {};
+        return it->second;
+    }
+
+    std::optional<double> estimate(std::string_view name, std::string_view version) {
+        if (const auto e = lookup(name, version))
+            return e->wall;
+
+        std::lock_guard lock{mtx};
+        if (const auto pkg = stats.find(name); pkg != stats.end())
+            return pkg->second.versions.at(pkg->second.last).wall;
+
+        if (stats.empty())
+            return {};
+        double sum = 0.0;
+        for (const auto& [_, pkg] : stats)
+            sum += pkg.versions.at(pkg.last).wall;
+        return sum / static_cast<double>(stats.size());
+    }
+
+    std::optional<std::size_t> parallelism(std::string_view name, std::string_view version) {
+        auto e = lookup(name, version);
+        if (!e) {
+            std::lock_guard lock{mtx};
+            const auto pkg = stats.find(name);
+            if (pkg == stats.end())
+                return {};
+            e = pkg->second.versions.at(pkg->second.last);
+        }
+        if (e->wall <= 0.0)
+            return {};
+
+        // A build that kept all of its jobs busy might scale further.
+        const double used = e->cpu / e->wall;
+        if (e->jobs == 0 || used >= 0.8 * static_cast<double>(e->jobs))
+            return {};
+        return std::max<std::size_t>(static_cast<std::size_t>(std::ceil(used)), 1);
+    }
+}
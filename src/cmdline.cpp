@@ -3,6 +3,7 @@
 #include <cstdio>
 #include "minipkg2.hpp"
 #include "cmdline.hpp"
+#include "utils.hpp"
 #include "print.hpp"
 
 namespace minipkg2 {
@@ -29,14 +30,19 @@ namespace minipkg2::cmdline {
     std::vector<operation*> operation::operations = {
         operations::clean,
         operations::config,
+        operations::db,
         operations::download,
         operations::help,
         operations::install,
         operations::list,
+        operations::owns,
         operations::purge,
+        operations::rdeps,
         operations::remove,
         operations::repo,
         operations::show,
+        operations::upgrade,
+        operations::why,
     };
 
     // Utility Functions
@@ -212,6 +218,8 @@ namespace minipkg2::cmdline {
             return 1;
         }
 
-        return (*op)(args);
+        const int ec = (*op)(args);
+        printerr(color::DEBUG, "{}: spawned {} child processes.", op->name, spawn_count.load());
+        return ec;
     }
 }
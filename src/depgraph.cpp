@@ -0,0 +1,193 @@
+#include <unordered_map>
+#include <optional>
+#include "depgraph.hpp"
+#include "utils.hpp"
+
+namespace minipkg2::depgraph {
+    namespace {
+        enum class state {
+            NEW,        // Loaded, but not visited yet.
+            ACTIVE,     // On the DFS stack.
+            DONE,
+        };
+        struct loaded_node {
+            node n;
+            state st = state::NEW;
+            std::optional<std::size_t> order{};     // Position in the result, once it was placed.
+        };
+        struct frame {
+            std::size_t idx;
+            bool runtime;       // Visiting rdepends (the package was already placed).
+            std::size_t pos;
+        };
+
+        struct resolver {
+            bool resolve_deps;
+            resolve_skip_policy policy;
+
+            std::vector<loaded_node> nodes{};
+            std::unordered_map<std::string, std::size_t> by_name{};    // Requested name -> node.
+            std::unordered_map<std::string, std::size_t> provided{};   // Names provided by placed nodes.
+            std::unordered_map<std::string, bool> installed{};
+            std::optional<std::unordered_map<std::string, std::string>> repo_provides{};   // Provided name -> package.
+            std::vector<std::size_t> order{};
+            std::vector<frame> stack{};
+
+            bool is_installed(const std::string& name) {
+                const auto it = installed.find(name);
+                if (it != installed.end())
+                    return it->second;
+                return installed[name] = installed_package::is_installed(name);
+            }
+            // Find a repo package that provides `name`, the repo is only indexed if needed.
+            std::optional<std::string> find_provider(const std::string& name) {
+                if (!repo_provides.has_value()) {
+                    repo_provides.emplace();
+                    for (const auto& pkg : source_package::parse_repo()) {
+                        for (const auto& p : pkg.provides)
+                            repo_provides->emplace(p, pkg.name);
+                    }
+                }
+                const auto it = repo_provides->find(name);
+                if (it == repo_provides->end())
+                    return {};
+                return it->second;
+            }
+            std::size_t load(const std::string& name) {
+                if (const auto it = by_name.find(name); it != by_name.end())
+                    return it->second;
+
+                auto result = source_package::parse_repo(name);
+                if (!result.has_value()) {
+                    if (const auto provider = find_provider(name); provider.has_value())
+                        result = source_package::parse_repo(provider.value());
+                }
+                if (!result.has_value())
+                    raise("Invalid package: {}", name);
+
+                // The directory name may differ from the package name.
+                std::size_t idx;
+                if (const auto it = by_name.find(result->name); it != by_name.end()) {
+                    idx = it->second;
+                } else {
+                    idx = nodes.size();
+                    by_name.emplace(result->name, idx);
+                    nodes.push_back(loaded_node{node{std::move(result.value()), {}, {}}});
+                }
+                by_name.emplace(name, idx);
+                return idx;
+            }
+            void place(std::size_t idx) {
+                auto& ln = nodes[idx];
+                ln.order = order.size();
+                order.push_back(idx);
+                provided.emplace(ln.n.pkg.name, idx);
+                for (const auto& p : ln.n.pkg.provides)
+                    provided.emplace(p, idx);
+            }
+            [[noreturn]]
+            void cycle(std::size_t idx) {
+                std::string path{};
+                auto it = std::find_if(begin(stack), end(stack), [idx](const frame& f) { return f.idx == idx; });
+                for (; it != end(stack); ++it)
+                    path += fmt::format("{} -> ", nodes[it->idx].n.pkg.name);
+                path += nodes[idx].n.pkg.name;
+                raise("Dependency cycle: {}", path);
+            }
+            // Returns the node that satisfies `name`, if any.
+            // A package on the stack may be a runtime-dependency (it will be placed later),
+            // but not a build-dependency.
+            std::optional<std::size_t> visit(const std::string& name, bool skip_installed, bool runtime) {
+                if (skip_installed && is_installed(name))
+                    return {};
+                if (const auto it = provided.find(name); it != provided.end())
+                    return it->second;
+
+                const auto idx = load(name);
+                auto& ln = nodes[idx];
+                if (ln.order.has_value())
+                    return idx;
+                if (ln.st == state::ACTIVE) {
+                    if (!runtime)
+                        cycle(idx);
+                    return idx;
+                }
+
+                if (!resolve_deps) {
+                    ln.st = state::DONE;
+                    place(idx);
+                    return idx;
+                }
+
+                ln.st = state::ACTIVE;
+                stack.push_back(frame{idx, false, 0});
+                return idx;
+            }
+            void run(const std::vector<std::string>& args) {
+                const bool skip_deps = policy != resolve_skip_policy::NEVER;
+                for (const auto& name : args) {
+                    visit(name, policy == resolve_skip_policy::ALWAYS, false);
+
+                    // Iterative DFS: visit the bdepends, place the package, visit the rdepends.
+                    while (!stack.empty()) {
+                        auto& f = stack.back();
+                        const auto idx = f.idx;
+                        const auto& pkg = nodes[idx].n.pkg;
+                        const auto& deps = f.runtime ? pkg.rdepends : pkg.bdepends;
+
+                        if (f.pos < deps.size()) {
+                            // Note: visit() may invalidate `f` and `deps`.
+                            const bool runtime = f.runtime;
+                            const auto name = deps[f.pos++];
+                            const auto dep = visit(name, skip_deps, runtime);
+                            if (dep.has_value()) {
+                                auto& edges = runtime ? nodes[idx].n.rdepends : nodes[idx].n.bdepends;
+                                edges.push_back(dep.value());
+                            }
+                            continue;
+                        }
+
+                        if (!f.runtime) {
+                            place(idx);
+                            f.runtime = true;
+                            f.pos = 0;
+                            continue;
+                        }
+
+                        nodes[idx].st = state::DONE;
+                        stack.pop_back();
+                    }
+                }
+            }
+            graph finish() {
+                graph g{};
+                g.nodes.reserve(order.size());
+                for (const auto idx : order) {
+                    auto& n = nodes[idx].n;
+                    const auto remap = [this](std::vector<std::size_t>& edges) {
+                        for (auto& e : edges)
+                            e = nodes[e].order.value();
+                    };
+                    remap(n.bdepends);
+                    remap(n.rdepends);
+                    g.nodes.push_back(std::move(n));
+                }
+                return g;
+            }
+        };
+    }
+
+    std::vector<source_package> graph::packages() && {
+        std::vector<source_package> pkgs{};
+        pkgs.reserve(nodes.size());
+        for (auto& n : nodes)
+            pkgs.push_back(std::move(n.pkg));
+        return pkgs;
+    }
+
+    graph resolve(const std::vector<std::string>& args, bool resolve_deps, resolve_skip_policy policy) {
+        resolver r{resolve_deps, policy};
+        r.run(args);
+        return r.finish();
+    }
+}
@@ -1,4 +1,16 @@
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <strings.h>
+#include <cstdlib>
+#include <cstdio>
+#include <optional>
+#include <chrono>
+#include <map>
+#include "minipkg2.hpp"
+#include "sourcecache.hpp"
+#include "download.hpp"
+#include "sha256.hpp"
 #include "utils.hpp"
 #include "print.hpp"
 
@@ -8,54 +20,497 @@
 
 namespace minipkg2 {
     bool download(const std::string& url, const std::string& dest, bool overwrite) {
-        if (!overwrite && ::access(dest.c_str(), F_OK) == 0)
+        std::vector<transfer> transfers{ { url, dest } };
+        return download(transfers, overwrite ? download_policy::ALWAYS : download_policy::DEFAULT) == 0;
+    }
+
+    // Get a file with a known checksum without downloading it, if possible.
+    static bool use_cache(const transfer& t) {
+        if (sourcecache::is_checked_out(t.sha256, t.dest))
             return true;
+        if (sourcecache::contains(t.sha256)) {
+            printerr(color::DEBUG, "Using cached '{}'.", t.url);
+            return sourcecache::checkout(t.sha256, t.dest);
+        }
+
+        // Files that were downloaded before the cache existed.
+        if (const auto digest = sha256::file(t.dest); digest.has_value()) {
+            if (digest.value() == t.sha256)
+                return sourcecache::add(t.dest, t.sha256);
+            printerr(color::WARN, "'{}' doesn't match its checksum, downloading it again.", t.dest);
+        }
+        return false;
+    }
 
 #if HAS_LIBCURL
-        static CURL* curl = nullptr;
+    using clock = std::chrono::steady_clock;
 
-        if (!curl) {
-            curl = ::curl_easy_init();
-            if (!curl) {
-                printerr(color::ERROR, "Failed to initialize libcurl.");
-                return false;
+    struct job {
+        transfer* t;
+        std::string host;
+        std::string part;           // The incomplete file.
+        std::string part_validators;// ETag and Last-Modified of the part, written before its first byte.
+        std::string validators;     // ETag and Last-Modified of the complete file.
+        bool revalidate;
+        std::size_t attempts = 0;
+        clock::time_point not_before{};
+
+        // State of the current attempt.
+        std::FILE* file = nullptr;
+        ::curl_slist* headers = nullptr;
+        ::curl_off_t offset = 0;
+        sha256::context hash{};
+        long status = 0;
+        std::string etag{}, last_modified{};
+        char errbuf[CURL_ERROR_SIZE];
+    };
+
+    static std::size_t config_count(const std::string& key, std::size_t fallback) {
+        const auto it = config.find(key);
+        if (it == config.end())
+            return fallback;
+        char* endp;
+        const auto n = std::strtoul(it->second.c_str(), &endp, 10);
+        return *endp == '\0' && !it->second.empty() ? n : fallback;
+    }
+
+    // The host part of an URL ("scheme://user@host:port/path"), only used to limit connections per host.
+    static std::string url_host(std::string_view url) {
+        auto begin = url.find("://");
+        begin = begin == std::string_view::npos ? 0 : begin + 3;
+        const auto end = std::min(url.find('/', begin), url.size());
+        auto host = url.substr(begin, end - begin);
+        if (const auto at = host.rfind('@'); at != std::string_view::npos)
+            host.remove_prefix(at + 1);
+        return std::string{host};
+    }
+
+    // "dir/name" -> "dir/.name<suffix>", hidden files aren't picked up by globs in package.build.
+    static std::string hidden_file(const std::string& dest, std::string_view suffix) {
+        const auto slash = dest.rfind('/');
+        const auto pos = slash == std::string::npos ? 0 : slash + 1;
+        return fmt::format("{}.{}{}", dest.substr(0, pos), dest.substr(pos), suffix);
+    }
+
+    static void read_validators(const std::string& filename, std::string& etag, std::string& last_modified) {
+        etag.clear();
+        last_modified.clear();
+        std::FILE* file = std::fopen(filename.c_str(), "r");
+        if (!file)
+            return;
+        std::string line{};
+        while (freadline(file, line)) {
+            if (starts_with(line, "ETag: ")) {
+                etag = line.substr(6);
+            } else if (starts_with(line, "Last-Modified: ")) {
+                last_modified = line.substr(15);
             }
+        }
+        std::fclose(file);
+    }
+    static void write_validators(const std::string& filename, const std::string& etag, const std::string& last_modified) {
+        if (etag.empty() && last_modified.empty()) {
+            rm(filename);
+            return;
+        }
+        std::FILE* file = std::fopen(filename.c_str(), "w");
+        if (!file)
+            return;
+        if (!etag.empty())
+            fmt::print(file, "ETag: {}\n", etag);
+        if (!last_modified.empty())
+            fmt::print(file, "Last-Modified: {}\n", last_modified);
+        std::fclose(file);
+    }
+
+    // Remember the validators of the final response (after redirects).
+    // They are written once its headers are complete, so that a part is never left without them.
+    static std::size_t header_callback(char* buffer, std::size_t size, std::size_t n, void* userdata) {
+        auto& j = *static_cast<job*>(userdata);
+        std::string_view line{buffer, size * n};
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.remove_suffix(1);
+
+        const auto match = [&line](std::string_view name) {
+            if (line.size() <= name.size() || line[name.size()] != ':' || ::strncasecmp(line.data(), name.data(), name.size()) != 0)
+                return false;
+            line.remove_prefix(name.size() + 1);
+            while (!line.empty() && line.front() == ' ')
+                line.remove_prefix(1);
+            return true;
+        };
+        if (starts_with(line, "HTTP/")) {
+            const auto space = line.find(' ');
+            j.status = space != std::string_view::npos ? std::strtol(std::string{line.substr(space + 1, 3)}.c_str(), nullptr, 10) : 0;
+            j.etag.clear();
+            j.last_modified.clear();
+        } else if (line.empty()) {
+            if (j.status == 200 || j.status == 206)
+                write_validators(j.part_validators, j.etag, j.last_modified);
+        } else if (match("ETag")) {
+            j.etag = line;
+        } else if (match("Last-Modified")) {
+            j.last_modified = line;
+        }
+        return size * n;
+    }
+
+    // Hash the data while it is written.
+    static std::size_t write_callback(char* data, std::size_t size, std::size_t n, void* userdata) {
+        auto& j = *static_cast<job*>(userdata);
+        const auto written = std::fwrite(data, size, n, j.file);
+        j.hash.update(data, written * size);
+        return written;
+    }
+
+    // A resumed download also needs the hash of the part that is already there.
+    static bool hash_part(job& j) {
+        std::FILE* file = std::fopen(j.part.c_str(), "rb");
+        if (!file)
+            return false;
+        char buffer[65536];
+        std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof buffer, file)) != 0)
+            j.hash.update(buffer, n);
+        const bool success = !std::ferror(file);
+        std::fclose(file);
+        return success;
+    }
+
+    // DNS results, TLS sessions and connections are shared by all transfers.
+    static CURLSH* share_handle() {
+        static CURLSH* share = nullptr;
+        if (!share) {
+            share = ::curl_share_init();
+            if (!share)
+                return nullptr;
+            ::curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            ::curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            ::curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
             ::atexit([]{
-                curl_easy_cleanup(curl);
-                curl = nullptr;
+                ::curl_share_cleanup(share);
+                share = nullptr;
             });
         }
+        return share;
+    }
 
+    static CURL* start_transfer(job& j) {
+        auto& t = *j.t;
+        if (!mkparentdirs(t.dest, 0755)) {
+            t.error = fmt::format("Failed to create parent directories of {}.", t.dest);
+            return nullptr;
+        }
 
-        if (!mkparentdirs(dest, 0755)) {
-            printerr(color::ERROR, "Failed to create parent directories of {}.", dest);
-            return false;
+        CURL* curl = ::curl_easy_init();
+        if (!curl) {
+            t.error = "Failed to initialize libcurl.";
+            return nullptr;
         }
 
-        std::FILE* file = std::fopen(dest.c_str(), "wb");
-        if (!file) {
-            printerr(color::ERROR, "Failed to open file '{}'", dest);
-            return false;
+        struct ::stat st;
+        j.offset = ::stat(j.part.c_str(), &st) == 0 ? st.st_size : 0;
+        std::string etag, last_modified;
+        read_validators(j.offset != 0 ? j.part_validators : j.validators, etag, last_modified);
+        // Without validators or a checksum, nothing would notice that the rest belongs to a different file.
+        if (j.offset != 0 && etag.empty() && last_modified.empty() && t.sha256.empty()) {
+            printerr(color::DEBUG, "Not resuming '{}', because the part can't be validated.", t.url);
+            j.offset = 0;
+        }
+        j.hash = sha256::context{};
+        if (j.offset != 0 && !hash_part(j))
+            j.offset = 0;
+        if (j.offset == 0)
+            rm(j.part_validators);
+        j.file = std::fopen(j.part.c_str(), j.offset != 0 ? "ab" : "wb");
+        if (!j.file) {
+            t.error = fmt::format("Failed to open file '{}'.", j.part);
+            ::curl_easy_cleanup(curl);
+            return nullptr;
         }
 
-        ::curl_easy_setopt(curl, CURLOPT_URL,             url.c_str());
-        ::curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,   fwrite);
-        ::curl_easy_setopt(curl, CURLOPT_WRITEDATA,       file);
-        ::curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION,  1);
+        if (j.offset != 0) {
+            // If the file changed on the server, it is sent completely and the part is discarded.
+            printerr(color::INFO, "Resuming '{}' at {} bytes.", t.url, j.offset);
+            ::curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, j.offset);
+            if (!etag.empty() || !last_modified.empty())
+                j.headers = ::curl_slist_append(j.headers, fmt::format("If-Range: {}", !etag.empty() ? etag : last_modified).c_str());
+        } else if (j.revalidate) {
+            if (!etag.empty())
+                j.headers = ::curl_slist_append(j.headers, fmt::format("If-None-Match: {}", etag).c_str());
+            if (!last_modified.empty())
+                j.headers = ::curl_slist_append(j.headers, fmt::format("If-Modified-Since: {}", last_modified).c_str());
+        }
 
-        const ::CURLcode result = curl_easy_perform(curl);
-        std::fclose(file);
-        if (result != CURLE_OK) {
-            printerr(color::ERROR, "Failed to download '{}': {}", url, ::curl_easy_strerror(result));
-            rm(dest);
+        j.status = 0;
+        j.etag.clear();
+        j.last_modified.clear();
+        j.errbuf[0] = '\0';
+        ::curl_easy_setopt(curl, CURLOPT_URL,             t.url.c_str());
+        ::curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,   write_callback);
+        ::curl_easy_setopt(curl, CURLOPT_WRITEDATA,       &j);
+        ::curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,  header_callback);
+        ::curl_easy_setopt(curl, CURLOPT_HEADERDATA,      &j);
+        ::curl_easy_setopt(curl, CURLOPT_HTTPHEADER,      j.headers);
+        ::curl_easy_setopt(curl, CURLOPT_ERRORBUFFER,     j.errbuf);
+        ::curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION,  1L);
+        ::curl_easy_setopt(curl, CURLOPT_FAILONERROR,     1L);
+        ::curl_easy_setopt(curl, CURLOPT_SHARE,           share_handle());
+        // Stalled transfers are aborted, and resumed by the next attempt.
+        ::curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT,  30L);
+        ::curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        ::curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME,  60L);
+        return curl;
+    }
+
+    // Errors that might go away by trying again.
+    static bool is_transient(::CURLcode result, long status) {
+        switch (result) {
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return true;
+        case CURLE_HTTP_RETURNED_ERROR:
+            return status == 408 || status == 429 || status >= 500;
+        default:
             return false;
         }
+    }
+
+    static download_policy resolve_policy(download_policy policy) {
+        if (policy != download_policy::DEFAULT)
+            return policy;
+        const auto it = config.find("download.revalidate");
+        return it != config.end() && it->second == "enable" ? download_policy::REVALIDATE : download_policy::MISSING;
+    }
+
+    std::size_t download(std::vector<transfer>& transfers, download_policy policy) {
+        policy = resolve_policy(policy);
+        const auto max_total    = std::max<std::size_t>(config_count("download.connections", 8), 1);
+        const auto max_host     = std::max<std::size_t>(config_count("download.host-connections", 4), 1);
+        const auto max_retries  = config_count("download.retries", 3);
+
+        std::vector<job> jobs{};
+        jobs.reserve(transfers.size());
+        for (auto& t : transfers) {
+            t.error.clear();
+            if (!t.sha256.empty() && policy != download_policy::ALWAYS && use_cache(t))
+                continue;
+            const bool exists = ::access(t.dest.c_str(), F_OK) == 0;
+            if (exists && policy == download_policy::MISSING && t.sha256.empty())
+                continue;
+            auto& j = jobs.emplace_back();
+            j.t = &t;
+            j.host = url_host(t.url);
+            j.part = hidden_file(t.dest, ".part");
+            j.part_validators = hidden_file(t.dest, ".part.validators");
+            j.validators = hidden_file(t.dest, ".validators");
+            j.revalidate = exists && policy == download_policy::REVALIDATE && t.sha256.empty();
+            if (policy == download_policy::ALWAYS) {
+                rm(j.part);
+                rm(j.part_validators);
+                rm(j.validators);
+            }
+        }
+        if (jobs.empty())
+            return 0;
+
+        CURLM* multi = ::curl_multi_init();
+        if (!multi) {
+            printerr(color::ERROR, "Failed to initialize libcurl.");
+            for (auto& j : jobs)
+                j.t->error = "Failed to initialize libcurl.";
+            return jobs.size();
+        }
+        ::curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,  static_cast<long>(max_host));
+        ::curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(max_total));
+
+        std::vector<job*> pending{};
+        for (auto& j : jobs)
+            pending.push_back(&j);
+        std::map<CURL*, job*> active{};
+        std::map<std::string, std::size_t> per_host{};
+        std::size_t num_done = 0, num_failed = 0;
+
+        const auto finish = [&](job& j, std::string_view status) {
+            ++num_done;
+            if (j.t->error.empty()) {
+                printerr(color::LOG, "({}/{}) {} '{}'.", num_done, jobs.size(), status, j.t->url);
+            } else {
+                printerr(color::ERROR, "({}/{}) Failed to download '{}': {}", num_done, jobs.size(), j.t->url, j.t->error);
+                ++num_failed;
+            }
+        };
+
+        // Start queued transfers in order, but skip hosts that are already busy and transfers that wait for a retry.
+        const auto fill = [&] {
+            const auto now = clock::now();
+            for (auto it = begin(pending); it != end(pending) && active.size() < max_total; ) {
+                auto& j = **it;
+                if (j.not_before > now || per_host[j.host] >= max_host) {
+                    ++it;
+                    continue;
+                }
+                it = pending.erase(it);
+                if (CURL* curl = start_transfer(j)) {
+                    ++per_host[j.host];
+                    active.emplace(curl, &j);
+                    ::curl_multi_add_handle(multi, curl);
+                } else {
+                    finish(j, "");
+                }
+            }
+        };
+
+        // Returns the status for finish(), or std::nullopt if the transfer is retried.
+        const auto complete = [&](job& j, CURL* curl, ::CURLcode result) -> std::optional<std::string_view> {
+            auto& t = *j.t;
+            long status = 0;
+            ::curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+            const bool closed = std::fclose(j.file) == 0;
+            j.file = nullptr;
+            ::curl_slist_free_all(j.headers);
+            j.headers = nullptr;
+
+            const auto discard_part = [&j] {
+                rm(j.part);
+                rm(j.part_validators);
+            };
+
+            if (result == CURLE_OK && !closed) {
+                t.error = fmt::format("Failed to write '{}'.", j.part);
+                discard_part();
+                return "";
+            }
+            if (result == CURLE_OK && status == 304) {
+                discard_part();
+                return "Up to date:";
+            }
+            if (result == CURLE_OK) {
+                const auto digest = j.hash.hex_digest();
+                if (!t.sha256.empty() && digest != t.sha256) {
+                    t.error = fmt::format("Checksum mismatch (expected {}, got {}).", t.sha256, digest);
+                    discard_part();
+                    return "";
+                }
+                if (std::rename(j.part.c_str(), t.dest.c_str()) != 0) {
+                    t.error = fmt::format("Failed to rename '{}'.", j.part);
+                    discard_part();
+                    return "";
+                }
+                // The validators of the part now belong to the file (a resumed part keeps those of its first response).
+                if (std::rename(j.part_validators.c_str(), j.validators.c_str()) != 0)
+                    rm(j.validators);
+                sourcecache::add(t.dest, digest);
+                return "Downloaded";
+            }
+
+            t.error = j.errbuf[0] != '\0' ? j.errbuf : ::curl_easy_strerror(result);
+            // A part is kept for the next attempt (or the next run), if the error might go away.
+            const bool transient = is_transient(result, status);
+            if (j.attempts >= max_retries) {
+                if (!transient)
+                    discard_part();
+                return "";
+            }
+
+            auto delay = std::chrono::seconds{1 << std::min<std::size_t>(j.attempts, 5)};
+            if (result == CURLE_RANGE_ERROR || (result == CURLE_HTTP_RETURNED_ERROR && status == 416)) {
+                // The file changed on the server, or the part is broken: start over immediately.
+                discard_part();
+                delay = std::chrono::seconds{0};
+                printerr(color::WARN, "Restarting '{}': {}", t.url, t.error);
+            } else if (transient) {
+                printerr(color::WARN, "Retrying '{}' in {}s ({}/{}): {}", t.url, delay.count(), j.attempts + 1, max_retries, t.error);
+            } else {
+                discard_part();
+                return "";
+            }
+
+            ++j.attempts;
+            t.error.clear();
+            j.not_before = clock::now() + delay;
+            pending.push_back(&j);
+            return std::nullopt;
+        };
+
+        fill();
+        while (!active.empty() || !pending.empty()) {
+            int running = 0;
+            if (const auto ec = ::curl_multi_perform(multi, &running); ec != CURLM_OK) {
+                printerr(color::ERROR, "libcurl: {}", ::curl_multi_strerror(ec));
+                break;
+            }
+
+            int queued = 0;
+            while (CURLMsg* msg = ::curl_multi_info_read(multi, &queued)) {
+                if (msg->msg != CURLMSG_DONE)
+                    continue;
+                CURL* curl = msg->easy_handle;
+                const auto it = active.find(curl);
+                auto& j = *it->second;
+                --per_host[j.host];
+                if (const auto status = complete(j, curl, msg->data.result))
+                    finish(j, *status);
+
+                ::curl_multi_remove_handle(multi, curl);
+                ::curl_easy_cleanup(curl);
+                active.erase(it);
+            }
+
+            fill();
+            if (active.empty() && pending.empty())
+                break;
+
+            // Sleep until a transfer makes progress, or until the next retry is due.
+            auto timeout = std::chrono::milliseconds{1000};
+            for (const auto* j : pending) {
+                const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(j->not_before - clock::now());
+                timeout = std::clamp(wait, std::chrono::milliseconds{1}, timeout);
+            }
+            ::curl_multi_poll(multi, nullptr, 0, static_cast<int>(timeout.count()), nullptr);
+        }
+
+        // Only reached with transfers left, if libcurl itself failed.
+        for (auto& [curl, j] : active) {
+            std::fclose(j->file);
+            ::curl_slist_free_all(j->headers);
+            j->t->error = "Aborted.";
+            ::curl_multi_remove_handle(multi, curl);
+            ::curl_easy_cleanup(curl);
+            ++num_failed;
+        }
+        for (auto* j : pending) {
+            j->t->error = "Aborted.";
+            ++num_failed;
+        }
+        ::curl_multi_cleanup(multi);
 
-        return true;
+        if (num_failed != 0)
+            printerr(color::ERROR, "{} of {} download(s) failed.", num_failed, jobs.size());
+        return num_failed;
+    }
 #else
-        (void)url;
-        printerr(color::ERROR, "Downloading files is not supported because minipkg2 was not built with curl support. Please rebuild minipkg2.");
-        return false;
-#endif
+    std::size_t download(std::vector<transfer>& transfers, download_policy policy) {
+        std::size_t num_failed = 0;
+        for (auto& t : transfers) {
+            if (!t.sha256.empty() && policy != download_policy::ALWAYS && use_cache(t))
+                continue;
+            if (t.sha256.empty() && policy != download_policy::ALWAYS && ::access(t.dest.c_str(), F_OK) == 0)
+                continue;
+            t.error = "minipkg2 was not built with curl support";
+            ++num_failed;
+        }
+        if (num_failed != 0)
+            printerr(color::ERROR, "Downloading files is not supported because minipkg2 was not built with curl support. Please rebuild minipkg2.");
+        return num_failed;
     }
+#endif
 }
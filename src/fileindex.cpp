@@ -0,0 +1,314 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
+#include <map>
+#include "fileindex.hpp"
+#include "minipkg2.hpp"
+#include "package.hpp"
+#include "quickdb.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::fileindex {
+    static constexpr char magic[8] = "MPKGFIX";
+    static constexpr std::uint32_t format_version = 1;
+
+    // On-disk layout: header, packages[], entries[] (sorted by path), string data.
+    struct str {
+        std::uint64_t off;
+        std::uint64_t len;
+    };
+    struct header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t num_packages;
+        std::uint64_t num_entries;
+    };
+    struct entry {
+        std::uint64_t path_off;
+        std::uint32_t path_len;
+        std::uint32_t package;
+    };
+
+    static void*            map         = nullptr;
+    static std::size_t      mapsize     = 0;
+    static const str*       packages    = nullptr;
+    static const entry*     entries     = nullptr;
+    static std::uint32_t    num_packages= 0;
+    static std::uint64_t    num_entries = 0;
+    // Packages changed during a quickdb::transaction, with their new files (normalized and sorted).
+    // They replace the entries of these packages in the index, until flush() writes them.
+    static std::map<std::string, std::vector<std::string>, std::less<>> pending{};
+
+    static std::string index_filename() {
+        return dbdir + "/files.idx";
+    }
+    static std::string_view get(std::uint64_t off, std::uint64_t len) {
+        return { static_cast<const char*>(map) + off, static_cast<std::size_t>(len) };
+    }
+    static std::string_view path_of(const entry& e) {
+        return get(e.path_off, e.path_len);
+    }
+    static std::string_view package_of(const entry& e) {
+        return get(packages[e.package].off, packages[e.package].len);
+    }
+
+    static void unload() {
+        if (map)
+            ::munmap(map, mapsize);
+        map = nullptr;
+        mapsize = 0;
+        packages = nullptr;
+        entries = nullptr;
+        num_packages = 0;
+        num_entries = 0;
+    }
+    static bool try_load() {
+        const auto filename = index_filename();
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct ::stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(header)) {
+            xclose(fd);
+            return false;
+        }
+
+        mapsize = static_cast<std::size_t>(st.st_size);
+        map = ::mmap(nullptr, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+        xclose(fd);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            mapsize = 0;
+            return false;
+        }
+
+        const auto* hdr = static_cast<const header*>(map);
+        if (std::memcmp(hdr->magic, magic, sizeof magic) != 0
+            || hdr->version != format_version
+            || sizeof(header) + hdr->num_packages * sizeof(str) + hdr->num_entries * sizeof(entry) > mapsize) {
+            printerr(color::WARN, "Discarding invalid file index '{}'.", filename);
+            unload();
+            return false;
+        }
+
+        packages = reinterpret_cast<const str*>(hdr + 1);
+        entries = reinterpret_cast<const entry*>(packages + hdr->num_packages);
+        num_packages = hdr->num_packages;
+        num_entries = hdr->num_entries;
+        return true;
+    }
+    static void load() {
+        if (map)
+            return;
+        if (!try_load() && (!rebuild() || !try_load()))
+            raise("Failed to load the file index.");
+    }
+
+    // Write a new index from (path, package) pairs.
+    static bool write(std::vector<std::pair<std::string_view, std::string_view>>& files) {
+        std::sort(begin(files), end(files));
+
+        std::map<std::string_view, std::uint32_t> package_ids{};
+        for (const auto& [_, name] : files)
+            package_ids.emplace(name, 0);
+
+        header hdr{};
+        std::memcpy(hdr.magic, magic, sizeof magic);
+        hdr.version = format_version;
+        hdr.num_packages = static_cast<std::uint32_t>(package_ids.size());
+        hdr.num_entries = files.size();
+
+        const std::uint64_t strings_off = sizeof(header) + hdr.num_packages * sizeof(str) + hdr.num_entries * sizeof(entry);
+        std::string strings{};
+
+        std::vector<str> package_table{};
+        for (auto& [name, id] : package_ids) {
+            id = static_cast<std::uint32_t>(package_table.size());
+            package_table.push_back(str{strings_off + strings.size(), name.size()});
+            strings += name;
+        }
+
+        std::vector<entry> table{};
+        table.reserve(files.size());
+        for (const auto& [path, name] : files) {
+            table.push_back(entry{strings_off + strings.size(), static_cast<std::uint32_t>(path.size()), package_ids[name]});
+            strings += path;
+        }
+
+        const auto filename = index_filename();
+        const auto tmpname = filename + ".tmp";
+        std::FILE* file = std::fopen(tmpname.c_str(), "wb");
+        if (!file) {
+            printerr(color::ERROR, "Failed to open '{}'.", tmpname);
+            return false;
+        }
+        bool success = std::fwrite(&hdr, sizeof hdr, 1, file) == 1;
+        success &= std::fwrite(package_table.data(), sizeof(str), package_table.size(), file) == package_table.size();
+        success &= std::fwrite(table.data(), sizeof(entry), table.size(), file) == table.size();
+        success &= std::fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+        success &= std::fclose(file) == 0;
+
+        // The old mapping may still be referenced by `files`.
+        unload();
+
+        if (!success || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+            printerr(color::ERROR, "Failed to write file index '{}'.", filename);
+            rm(tmpname);
+            return false;
+        }
+        return true;
+    }
+
+    std::string normalize(std::string_view path) {
+        if (starts_with(path, "./"))
+            path.remove_prefix(1);
+        std::string result{};
+        if (path.empty() || path.front() != '/')
+            result += '/';
+        result += path;
+        return result;
+    }
+
+    std::string repair_legacy(std::string_view path) {
+        if (path.empty() || path.front() == '/')
+            return std::string{path};
+
+        // The top-level entries of the root, by their name without the first character ("sr" -> "usr").
+        // Names that are ambiguous map to an empty string.
+        static const auto candidates = [] {
+            std::map<std::string, std::string, std::less<>> result{};
+            ::DIR* dir = ::opendir(rootdir.c_str());
+            if (!dir)
+                return result;
+            struct ::dirent* ent;
+            while ((ent = ::readdir(dir)) != nullptr) {
+                const std::string_view name{ent->d_name};
+                if (name.size() < 2 || name == "..")
+                    continue;
+                const auto [it, inserted] = result.emplace(name.substr(1), name);
+                if (!inserted)
+                    it->second.clear();
+            }
+            ::closedir(dir);
+            return result;
+        }();
+
+        const auto component = path.substr(0, path.find('/'));
+        const auto it = candidates.find(component);
+        if (it == candidates.end() || it->second.empty()
+            || ::access(fmt::format("{}/{}", rootdir, component).c_str(), F_OK) == 0)
+            return normalize(path);
+        return fmt::format("/{}{}", it->second, path.substr(component.size()));
+    }
+
+    std::vector<std::string> owners(std::string_view path) {
+        load();
+        const auto p = normalize(path);
+        const auto* end = entries + num_entries;
+        const auto* it = std::lower_bound(entries, end, p, [](const entry& e, std::string_view p) {
+            return path_of(e) < p;
+        });
+
+        std::vector<std::string> result{};
+        for (; it != end && path_of(*it) == p; ++it) {
+            if (pending.find(package_of(*it)) == pending.end())
+                result.emplace_back(package_of(*it));
+        }
+        for (const auto& [pkg, pkg_files] : pending) {
+            if (std::binary_search(pkg_files.begin(), pkg_files.end(), p))
+                result.push_back(pkg);
+        }
+        return result;
+    }
+    std::vector<std::pair<std::string, std::string>> collisions(std::string_view name, std::vector<std::string> files) {
+        load();
+        for (auto& f : files)
+            f = normalize(f);
+        std::sort(begin(files), end(files));
+
+        // Walk through both sorted lists at once, each search starts where the previous one ended.
+        std::vector<std::pair<std::string, std::string>> result{};
+        const auto* it = entries;
+        const auto* end = entries + num_entries;
+        for (const auto& f : files) {
+            if (ends_with(f, "/"))
+                continue;
+
+            it = std::lower_bound(it, end, f, [](const entry& e, std::string_view p) {
+                return path_of(e) < p;
+            });
+            for (; it != end && path_of(*it) == f; ++it) {
+                if (package_of(*it) != name && pending.find(package_of(*it)) == pending.end())
+                    result.emplace_back(f, package_of(*it));
+            }
+        }
+
+        for (const auto& [pkg, pkg_files] : pending) {
+            if (pkg == name)
+                continue;
+            std::vector<std::string> common{};
+            std::set_intersection(files.begin(), files.end(), pkg_files.begin(), pkg_files.end(), std::back_inserter(common));
+            for (auto& f : common)
+                result.emplace_back(std::move(f), pkg);
+        }
+        return result;
+    }
+    bool update(const std::string& name, const std::vector<std::string>& files) {
+        std::vector<std::string> normalized{};
+        normalized.reserve(files.size());
+        for (const auto& f : files) {
+            if (!ends_with(f, "/"))
+                normalized.push_back(normalize(f));
+        }
+        std::sort(begin(normalized), end(normalized));
+        pending.insert_or_assign(name, std::move(normalized));
+
+        return quickdb::in_transaction() || flush();
+    }
+    bool flush() {
+        if (pending.empty())
+            return true;
+        load();
+
+        std::vector<std::pair<std::string_view, std::string_view>> merged{};
+        merged.reserve(num_entries);
+        for (std::uint64_t i = 0; i < num_entries; ++i) {
+            if (pending.find(package_of(entries[i])) == pending.end())
+                merged.emplace_back(path_of(entries[i]), package_of(entries[i]));
+        }
+        for (const auto& [pkg, pkg_files] : pending) {
+            for (const auto& f : pkg_files)
+                merged.emplace_back(f, pkg);
+        }
+
+        const bool success = write(merged);
+        pending.clear();
+        return success;
+    }
+    bool rebuild() {
+        printerr(color::DEBUG, "Rebuilding the file index...");
+
+        std::vector<std::pair<std::string, std::string>> all{};
+        for (const auto& pkg : installed_package::parse_local()) {
+            for (const auto& f : installed_package::get_files(pkg.name)) {
+                if (!ends_with(f, "/"))
+                    all.emplace_back(normalize(f), pkg.name);
+            }
+        }
+
+        std::vector<std::pair<std::string_view, std::string_view>> files{};
+        files.reserve(all.size());
+        for (const auto& [path, name] : all)
+            files.emplace_back(path, name);
+        return write(files);
+    }
+}
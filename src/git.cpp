@@ -1,5 +1,8 @@
 #include <unistd.h>
+#include <cstdlib>
+#include "minipkg2.hpp"
 #include "utils.hpp"
+#include "print.hpp"
 #include "git.hpp"
 
 namespace minipkg2::git {
@@ -18,19 +21,50 @@ namespace minipkg2::git {
         return "";
     }
 
-    static int xsystem(std::string&& s) {
-        return std::system(s.c_str());
-    }
-
-    bool clone(const std::string& url, const std::string& dest, const std::string& branch) {
+    bool clone(const std::string& url, const std::string& dest, const std::string& branch,
+               std::size_t depth, const std::string& filter) {
         std::string cmd = "git clone " + verbosity_option() + " '" + std::string{url} + "' '" + dest + '\'';
         if (branch.size() != 0)
             cmd += " --branch '" + branch + '\'';
+        // Keep all branches, so that the branch can still be changed later.
+        if (depth != 0)
+            cmd += fmt::format(" --depth {} --no-single-branch", depth);
+        if (!filter.empty())
+            cmd += " --filter='" + filter + '\'';
 
-        return std::system(cmd.c_str()) == 0;
+        return xsystem(cmd) == 0;
     }
-    bool pull(const std::string& repo) {
-        return xsystem("cd '" + repo + "' && git pull " + verbosity_option()) == 0;
+    std::optional<std::vector<change>> fast_forward(const std::string& repo) {
+        const auto git = "git -C '" + repo + "' ";
+        const auto [ec_head, old_head] = xpread(git + "rev-parse HEAD");
+        if (ec_head != 0)
+            return {};
+
+        // A shallow or partial clone stays shallow or partial, only the new commits are fetched.
+        if (xsystem(git + "fetch --prune " + verbosity_option()) != 0
+            || xsystem(git + "merge --ff-only " + verbosity_option() + " '@{upstream}'") != 0)
+            return {};
+
+        // Only the trees are compared, so a partial clone doesn't need to fetch any blobs.
+        const auto [ec, reply] = xpread(git + "-c core.quotePath=false diff --name-status --no-renames " + old_head + " HEAD");
+        if (ec != 0)
+            return {};
+
+        std::vector<change> changes{};
+        std::string_view rest{reply};
+        while (!rest.empty()) {
+            const auto end = std::min(rest.find('\n'), rest.size());
+            const auto line = rest.substr(0, end);
+            rest.remove_prefix(std::min(end + 1, rest.size()));
+
+            const auto tab = line.find('\t');
+            if (tab == std::string_view::npos || tab == 0)
+                continue;
+            // Changes of the file type ('T') are modifications.
+            const char status = line[0] == 'A' || line[0] == 'D' ? line[0] : 'M';
+            changes.push_back({status, std::string{line.substr(tab + 1)}});
+        }
+        return changes;
     }
     bool checkout(const std::string& repo, const std::string& branch) {
         return xsystem("cd '" + repo + "' && git checkout " + verbosity_option() + " '" + branch + '\'') == 0;
@@ -39,7 +73,82 @@ namespace minipkg2::git {
         auto [ec, reply] = xpread("cd '" + repo + "' && git branch --show-current");
         return ec == 0 ? reply : std::string{};
     }
-    bool sync(const std::string& url, const std::string& dest) {
-        return access(dest.c_str(), F_OK) == 0 ? pull(dest) : clone(url, dest, {});
+
+    std::optional<source> parse_source(std::string_view src) {
+        source result{};
+        if (starts_with(src, "git+")) {
+            src.remove_prefix(4);
+        } else if (!starts_with(src, "git://")) {
+            return {};
+        }
+
+        const auto hash = src.find('#');
+        result.url = src.substr(0, hash);
+        if (hash == std::string_view::npos)
+            return result;
+
+        auto fragment = src.substr(hash + 1);
+        while (!fragment.empty()) {
+            const auto end = std::min(fragment.find('&'), fragment.size());
+            const auto option = fragment.substr(0, end);
+            fragment.remove_prefix(std::min(end + 1, fragment.size()));
+
+            if (starts_with(option, "branch=")) {
+                result.branch = option.substr(7);
+            } else if (starts_with(option, "depth=")) {
+                result.depth = std::strtoul(std::string{option.substr(6)}.c_str(), nullptr, 10);
+            } else {
+                printerr(color::WARN, "Ignoring unknown option '{}' of git source '{}'.", option, result.url);
+            }
+        }
+        return result;
+    }
+
+    std::string mirror_path(std::string_view url) {
+        // "https://example.org/foo/bar.git" -> "$cachedir/git/example.org_foo_bar.git", "file:///srv/foo" -> "srv_foo.git"
+        if (const auto scheme = url.find("://"); scheme != std::string_view::npos)
+            url.remove_prefix(scheme + 3);
+        std::string name{};
+        for (const char c : url)
+            name += (c == '/' || c == ':' || c == '@') ? '_' : c;
+        while (!name.empty() && name.back() == '_')
+            name.pop_back();
+        while (!name.empty() && name.front() == '_')
+            name.erase(0, 1);
+        if (!ends_with(name, ".git"))
+            name += ".git";
+        return fmt::format("{}/git/{}", cachedir, name);
+    }
+
+    bool update_mirror(const source& src) {
+        const auto path = mirror_path(src.url);
+        const auto depth = src.depth != 0 ? fmt::format(" --depth {}", src.depth) : std::string{};
+
+        if (::access(path.c_str(), F_OK) != 0) {
+            if (!mkparentdirs(path, 0755))
+                return false;
+            // All branches are kept, even if only their tips are fetched.
+            const auto shallow = src.depth != 0 ? depth + " --no-single-branch" : std::string{};
+            return xsystem("git clone --mirror " + verbosity_option() + shallow + " '" + src.url + "' '" + path + '\'') == 0;
+        }
+
+        // A complete mirror stays complete, a shallow mirror is completed if a package needs the history.
+        const auto [ec, reply] = xpread("git -C '" + path + "' rev-parse --is-shallow-repository");
+        const bool is_shallow = ec == 0 && starts_with(reply, "true");
+        std::string options = " --prune";
+        if (is_shallow)
+            options += src.depth != 0 ? depth : std::string{" --unshallow"};
+        return xsystem("git -C '" + path + "' fetch " + verbosity_option() + options + " origin") == 0;
+    }
+
+    bool checkout_source(const source& src, const std::string& dest) {
+        // The checkout is cheap, because the objects are not copied.
+        rm_rf(dest);
+        if (!mkparentdirs(dest, 0755))
+            return false;
+        std::string cmd = "git clone --shared " + verbosity_option() + " '" + mirror_path(src.url) + "' '" + dest + '\'';
+        if (!src.branch.empty())
+            cmd += " --branch '" + src.branch + '\'';
+        return xsystem(cmd) == 0;
     }
 }
@@ -0,0 +1,120 @@
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "jobserver.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::jobserver {
+    static constexpr char token = '+';
+
+    static int pipefd[2] = { -1, -1 };
+    static std::size_t num_tokens = 0;
+    static std::size_t num_jobs = 0;
+    static std::atomic<std::size_t> implicit_jobs{0};
+
+    // The utilization is sampled periodically by a background thread.
+    static std::thread sampler{};
+    static std::mutex sampler_mtx;
+    static std::condition_variable sampler_cv;
+    static bool sampler_stop = false;
+    static std::size_t num_samples = 0;
+    static std::size_t sum_in_use = 0;
+    static std::size_t peak_in_use = 0;
+
+    static std::size_t available_tokens() {
+        int n = 0;
+        if (::ioctl(pipefd[0], FIONREAD, &n) != 0 || n < 0)
+            return num_tokens;
+        return static_cast<std::size_t>(n);
+    }
+    static void sample() {
+        std::unique_lock lock{sampler_mtx};
+        while (!sampler_cv.wait_for(lock, std::chrono::milliseconds(100), [] { return sampler_stop; })) {
+            const auto in_use = implicit_jobs.load() + num_tokens - std::min(available_tokens(), num_tokens);
+            ++num_samples;
+            sum_in_use += in_use;
+            peak_in_use = std::max(peak_in_use, in_use);
+        }
+    }
+
+    slot::slot() {
+        ++implicit_jobs;
+    }
+    slot::~slot() {
+        --implicit_jobs;
+    }
+
+    void start(std::size_t jobs, std::size_t slots) {
+        if (active())
+            return;
+
+        xpipe(pipefd);
+        num_jobs = jobs;
+        num_tokens = jobs > slots ? jobs - slots : 0;
+
+        const std::string tokens(num_tokens, token);
+        if (::write(pipefd[1], tokens.data(), tokens.size()) != static_cast<ssize_t>(tokens.size()))
+            raise("Failed to fill the jobserver pipe.");
+
+        printerr(color::DEBUG, "Started jobserver with {} token(s) for {} job(s).", num_tokens, num_jobs);
+
+        sampler_stop = false;
+        num_samples = sum_in_use = peak_in_use = 0;
+        sampler = std::thread{sample};
+    }
+    void stop() {
+        if (!active())
+            return;
+
+        {
+            std::lock_guard lock{sampler_mtx};
+            sampler_stop = true;
+        }
+        sampler_cv.notify_one();
+        sampler.join();
+
+        // Tokens of builds that were killed are lost.
+        if (const auto available = available_tokens(); available < num_tokens)
+            printerr(color::WARN, "{} jobserver token(s) were not returned.", num_tokens - available);
+
+        if (num_samples != 0) {
+            const double average = static_cast<double>(sum_in_use) / static_cast<double>(num_samples);
+            printerr(color::LOG, "Jobserver: {:.1f} of {} job(s) used on average ({:.0f}%), peak {}.",
+                     average, num_jobs, 100.0 * average / static_cast<double>(num_jobs), peak_in_use);
+        }
+
+        xclose(pipefd[0]);
+        xclose(pipefd[1]);
+        pipefd[0] = pipefd[1] = -1;
+    }
+
+    bool active() {
+        return pipefd[0] >= 0;
+    }
+
+    void inherit(std::vector<char*>& env, posix_spawn_file_actions_t& actions) {
+        if (!active())
+            return;
+
+        // The jobserver of a parent make must not be used.
+        for (auto it = begin(env); it != end(env); ) {
+            if (starts_with(*it, "MAKEFLAGS=") || starts_with(*it, "MFLAGS=")) {
+                delete[] *it;
+                it = env.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        add_environ(env, "MAKEFLAGS", fmt::format(" -j --jobserver-auth={},{}", pipefd[0], pipefd[1]));
+
+        // Duplicating a descriptor onto itself clears close-on-exec.
+        ::posix_spawn_file_actions_adddup2(&actions, pipefd[0], pipefd[0]);
+        ::posix_spawn_file_actions_adddup2(&actions, pipefd[1], pipefd[1]);
+    }
+}
@@ -0,0 +1,489 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <cstring>
+#include <cstdio>
+#include <set>
+#include <map>
+#include "bashconfig.hpp"
+#include "minipkg2.hpp"
+#include "localdb.hpp"
+#include "package.hpp"
+#include "quickdb.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::localdb {
+    static constexpr char magic[8] = "MPKGLDB";
+    static constexpr std::uint32_t format_version = 1;
+
+    // On-disk layout: header, packages[], names[], buckets[], string data.
+    struct str {
+        std::uint64_t off;
+        std::uint64_t len;
+    };
+    struct header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t num_packages;
+        std::uint32_t num_names;
+        std::uint32_t num_buckets;
+    };
+    struct package_entry {
+        str name;
+        str info;       // package.info, as written by bashconfig::write()
+        str files;      // One file per line.
+    };
+    struct name_entry {
+        str name;
+        std::int32_t package;   // Index of the package that is or provides this name, or -1.
+        std::uint32_t hash;
+        str rdeps;              // Installed packages that depend on this name, one per line.
+    };
+
+    struct record {
+        std::string info;
+        std::vector<std::string> files;
+        std::set<std::string> provides{};   // Provided names and dependencies, from the info.
+        std::set<std::string> depends{};
+    };
+    using database = std::map<std::string, record, std::less<>>;
+
+    static void*                map         = nullptr;
+    static std::size_t          mapsize     = 0;
+    static bool                 loaded      = false;
+    static const header*        hdr         = nullptr;
+    static const package_entry* pkgs        = nullptr;
+    static const name_entry*    names       = nullptr;
+    static const std::uint32_t* buckets     = nullptr;
+    // Modifications during a quickdb::transaction are applied to a copy of the whole database, that is written by flush().
+    static std::optional<database> pending{};
+
+    static std::string db_filename() {
+        return dbdir + "/local.db";
+    }
+    static std::uint32_t hash(std::string_view s) noexcept {
+        // FNV-1a
+        std::uint32_t h = 2166136261u;
+        for (const char ch : s) {
+            h ^= static_cast<unsigned char>(ch);
+            h *= 16777619u;
+        }
+        return h;
+    }
+    static std::string_view get(const str& s) {
+        return { static_cast<const char*>(map) + s.off, static_cast<std::size_t>(s.len) };
+    }
+    static std::vector<std::string> split_lines(std::string_view s) {
+        std::vector<std::string> lines{};
+        while (!s.empty()) {
+            const auto end = s.find('\n');
+            lines.emplace_back(s.substr(0, end));
+            s.remove_prefix(end == std::string_view::npos ? s.size() : end + 1);
+        }
+        return lines;
+    }
+
+    static void unload() {
+        if (map)
+            ::munmap(map, mapsize);
+        map = nullptr;
+        mapsize = 0;
+        hdr = nullptr;
+        loaded = false;
+    }
+    static bool load() {
+        if (loaded)
+            return hdr != nullptr;
+        loaded = true;
+
+        const auto filename = db_filename();
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct ::stat st;
+        if (::fstat(fd, &st) != 0) {
+            xclose(fd);
+            return false;
+        }
+        mapsize = static_cast<std::size_t>(st.st_size);
+        map = mapsize >= sizeof(header) ? ::mmap(nullptr, mapsize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        xclose(fd);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            raise("{}: Invalid database.", filename);
+        }
+
+        hdr = static_cast<const header*>(map);
+        const std::size_t size = sizeof(header)
+                               + hdr->num_packages * sizeof(package_entry)
+                               + hdr->num_names * sizeof(name_entry)
+                               + hdr->num_buckets * sizeof(std::uint32_t);
+        if (std::memcmp(hdr->magic, magic, sizeof magic) != 0 || hdr->version != format_version || size > mapsize || hdr->num_buckets == 0)
+            raise("{}: Invalid or unsupported database.", filename);
+
+        pkgs    = reinterpret_cast<const package_entry*>(hdr + 1);
+        names   = reinterpret_cast<const name_entry*>(pkgs + hdr->num_packages);
+        buckets = reinterpret_cast<const std::uint32_t*>(names + hdr->num_names);
+        return true;
+    }
+    static const name_entry* find(std::string_view name) {
+        if (!load())
+            return nullptr;
+        const auto h = hash(name);
+        for (std::uint32_t i = h % hdr->num_buckets;; i = (i + 1) % hdr->num_buckets) {
+            const auto idx = buckets[i];
+            if (idx == 0)
+                return nullptr;
+            const auto& e = names[idx - 1];
+            if (e.hash == h && get(e.name) == name)
+                return &e;
+        }
+    }
+    static const package_entry* find_package(std::string_view name) {
+        const auto* e = find(name);
+        if (!e || e->package < 0)
+            return nullptr;
+        return &pkgs[e->package];
+    }
+
+    bool enabled() {
+        return pending.has_value() || load();
+    }
+    std::optional<std::string> resolve(std::string_view name) {
+        if (pending) {
+            if (pending->find(name) != pending->end())
+                return std::string{name};
+            for (const auto& [pkg, rec] : *pending) {
+                if (rec.provides.count(std::string{name}) != 0)
+                    return pkg;
+            }
+            return {};
+        }
+
+        const auto* e = find(name);
+        if (!e || e->package < 0)
+            return {};
+        return std::string{get(pkgs[e->package].name)};
+    }
+    std::optional<std::string> info(std::string_view name) {
+        if (pending) {
+            const auto it = pending->find(name);
+            return it != pending->end() ? std::optional{it->second.info} : std::nullopt;
+        }
+
+        const auto* pkg = find_package(name);
+        if (!pkg)
+            return {};
+        return std::string{get(pkg->info)};
+    }
+    std::vector<std::string> files(std::string_view name) {
+        if (pending) {
+            const auto it = pending->find(name);
+            if (it == pending->end())
+                raise("Package '{}' is not installed.", name);
+            return it->second.files;
+        }
+
+        const auto* pkg = find_package(name);
+        if (!pkg)
+            raise("Package '{}' is not installed.", name);
+        return split_lines(get(pkg->files));
+    }
+    std::vector<std::string> rdeps(std::string_view name) {
+        if (pending) {
+            std::vector<std::string> result{};
+            for (const auto& [pkg, rec] : *pending) {
+                if (rec.depends.count(std::string{name}) != 0)
+                    result.push_back(pkg);
+            }
+            return result;
+        }
+
+        const auto* e = find(name);
+        return e ? split_lines(get(e->rdeps)) : std::vector<std::string>{};
+    }
+    std::vector<std::string> packages() {
+        std::vector<std::string> result{};
+        if (pending) {
+            for (const auto& [pkg, _] : *pending)
+                result.push_back(pkg);
+            return result;
+        }
+        if (!load())
+            return result;
+        for (std::uint32_t i = 0; i < hdr->num_packages; ++i)
+            result.emplace_back(get(pkgs[i].name));
+        return result;
+    }
+
+    // Writing
+
+    static std::string config_to_string(const bashconfig::config& conf) {
+        char* buf = nullptr;
+        std::size_t size = 0;
+        std::FILE* file = ::open_memstream(&buf, &size);
+        if (!file)
+            raise("open_memstream() failed.");
+        bashconfig::write(file, conf);
+        std::fclose(file);
+        std::string result{buf, size};
+        std::free(buf);
+        return result;
+    }
+
+    // Get the provided names and the runtime dependencies from a package.info.
+    static void scan_info(const std::string& info, std::set<std::string>& provides, std::set<std::string>& depends) {
+        std::FILE* file = ::fmemopen(const_cast<char*>(info.data()), info.size(), "r");
+        if (!file)
+            raise("fmemopen() failed.");
+        const auto conf = bashconfig::read(file);
+        std::fclose(file);
+
+        const auto add = [&conf](std::set<std::string>& out, const char* name) {
+            const auto it = conf.find(name);
+            if (it == conf.end())
+                return;
+            if (const auto* s = std::get_if<std::string>(&it->second)) {
+                out.insert(*s);
+            } else {
+                const auto& vec = std::get<std::vector<std::string>>(it->second);
+                out.insert(begin(vec), end(vec));
+            }
+        };
+        add(provides, "provides");
+        add(depends, "depends");
+        add(depends, "rdepends");
+    }
+    static record make_record(std::string info, std::vector<std::string> files) {
+        record rec{std::move(info), std::move(files)};
+        scan_info(rec.info, rec.provides, rec.depends);
+        return rec;
+    }
+    static database read_all() {
+        if (pending)
+            return *pending;
+
+        database db{};
+        if (!load())
+            return db;
+        for (std::uint32_t i = 0; i < hdr->num_packages; ++i) {
+            const auto& pkg = pkgs[i];
+            db.emplace(get(pkg.name), make_record(std::string{get(pkg.info)}, split_lines(get(pkg.files))));
+        }
+        return db;
+    }
+    static bool write_all(const database& db) {
+        struct name_info {
+            std::int32_t package = -1;
+            std::set<std::string> rdeps{};
+        };
+        std::map<std::string, name_info> name_map{};
+
+        std::int32_t idx = 0;
+        for (const auto& [name, rec] : db) {
+            for (const auto& p : rec.provides) {
+                auto& n = name_map[p];
+                if (n.package < 0)
+                    n.package = idx;
+            }
+            for (const auto& d : rec.depends)
+                name_map[d].rdeps.insert(name);
+            // The package's own name has priority over provided names.
+            name_map[name].package = idx;
+            ++idx;
+        }
+
+        header h{};
+        std::memcpy(h.magic, magic, sizeof magic);
+        h.version = format_version;
+        h.num_packages = static_cast<std::uint32_t>(db.size());
+        h.num_names = static_cast<std::uint32_t>(name_map.size());
+        h.num_buckets = static_cast<std::uint32_t>(name_map.size() * 2 + 1);
+
+        const std::uint64_t strings_off = sizeof(header)
+                                        + h.num_packages * sizeof(package_entry)
+                                        + h.num_names * sizeof(name_entry)
+                                        + h.num_buckets * sizeof(std::uint32_t);
+        std::string strings{};
+        const auto add_str = [&strings, strings_off](std::string_view s) {
+            str result{strings_off + strings.size(), s.size()};
+            strings += s;
+            return result;
+        };
+        const auto add_lines = [&add_str](const auto& lines) {
+            std::string tmp{};
+            for (const auto& l : lines) {
+                tmp += l;
+                tmp += '\n';
+            }
+            return add_str(tmp);
+        };
+
+        std::vector<package_entry> pkg_table{};
+        for (const auto& [name, rec] : db)
+            pkg_table.push_back(package_entry{add_str(name), add_str(rec.info), add_lines(rec.files)});
+
+        std::vector<name_entry> name_table{};
+        std::vector<std::uint32_t> bucket_table(h.num_buckets, 0);
+        for (const auto& [name, n] : name_map) {
+            const auto hsh = hash(name);
+            name_table.push_back(name_entry{add_str(name), n.package, hsh, add_lines(n.rdeps)});
+            std::uint32_t i = hsh % h.num_buckets;
+            while (bucket_table[i] != 0)
+                i = (i + 1) % h.num_buckets;
+            bucket_table[i] = static_cast<std::uint32_t>(name_table.size());
+        }
+
+        const auto filename = db_filename();
+        const auto tmpname = filename + ".tmp";
+        std::FILE* file = std::fopen(tmpname.c_str(), "wb");
+        if (!file) {
+            printerr(color::ERROR, "Failed to open '{}'.", tmpname);
+            return false;
+        }
+        bool success = std::fwrite(&h, sizeof h, 1, file) == 1;
+        success &= std::fwrite(pkg_table.data(), sizeof(package_entry), pkg_table.size(), file) == pkg_table.size();
+        success &= std::fwrite(name_table.data(), sizeof(name_entry), name_table.size(), file) == name_table.size();
+        success &= std::fwrite(bucket_table.data(), sizeof(std::uint32_t), bucket_table.size(), file) == bucket_table.size();
+        success &= std::fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+        success &= std::fclose(file) == 0;
+
+        if (!success || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+            printerr(color::ERROR, "Failed to write '{}'.", filename);
+            rm(tmpname);
+            return false;
+        }
+
+        unload();
+        return true;
+    }
+
+    // Outside of a transaction, every modification is written immediately.
+    static database& modify() {
+        if (!pending)
+            pending = read_all();
+        return *pending;
+    }
+    static void written() {
+        if (!quickdb::in_transaction() && !flush())
+            raise("Failed to update the database.");
+    }
+
+    void put(const std::string& name, const bashconfig::config& info, const std::vector<std::string>& files) {
+        modify().insert_or_assign(name, make_record(config_to_string(info), files));
+        written();
+    }
+    void erase(const std::string& name) {
+        modify().erase(name);
+        written();
+    }
+    bool flush() {
+        if (!pending)
+            return true;
+        const auto db = std::move(*pending);
+        pending.reset();
+        return write_all(db);
+    }
+
+    // Migration
+
+    bool migrate() {
+        if (enabled()) {
+            printerr(color::WARN, "'{}' already exists.", db_filename());
+            return true;
+        }
+
+        ::DIR* dir = ::opendir(pkgdir.c_str());
+        if (!dir) {
+            printerr(color::ERROR, "Failed to open directory '{}'.", pkgdir);
+            return false;
+        }
+
+        std::vector<std::string> entries{};
+        struct ::dirent* ent;
+        while ((ent = ::readdir(dir)) != nullptr) {
+            if (ent->d_name[0] != '.')
+                entries.emplace_back(ent->d_name);
+        }
+        ::closedir(dir);
+
+        database db{};
+        for (const auto& name : entries) {
+            const auto path = fmt::format("{}/{}", pkgdir, name);
+            struct ::stat st;
+            // Provided packages are symlinks and will be recreated from the package.info.
+            if (::lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+                continue;
+
+            auto pkg = installed_package::parse_file(path + "/package.info");
+            if (!pkg.has_value()) {
+                printerr(color::ERROR, "Failed to parse package '{}'.", name);
+                return false;
+            }
+            const auto files = installed_package::get_files(name);
+            db.emplace(name, make_record(config_to_string(pkg->to_config()), {begin(files), end(files)}));
+        }
+
+        if (!write_all(db))
+            return false;
+
+        // From now on, local.db is used.
+        for (const auto& name : entries)
+            rm_rf(fmt::format("{}/{}", pkgdir, name));
+
+        printerr(color::INFO, "Migrated {} packages to '{}'.", db.size(), db_filename());
+        return true;
+    }
+    bool export_files() {
+        if (!enabled()) {
+            printerr(color::WARN, "'{}' doesn't exist.", db_filename());
+            return true;
+        }
+
+        const auto db = read_all();
+        quickdb::quickdb conflicts{}, rdeps{};
+        bool success = true;
+        for (const auto& [name, rec] : db) {
+            const auto dir = fmt::format("{}/{}", pkgdir, name);
+            mkdir_p(dir);
+            success &= write_file(dir + "/package.info", rec.info);
+
+            std::string files{};
+            for (const auto& f : rec.files) {
+                files += f;
+                files += '\n';
+            }
+            success &= write_file(dir + "/files", files);
+
+            for (const auto& p : rec.provides) {
+                if (p != name)
+                    symlink_v(name, fmt::format("{}/{}", pkgdir, p));
+            }
+
+            auto pkg = installed_package::parse_file(dir + "/package.info");
+            if (pkg.has_value())
+                conflicts[name] = pkg->conflicts;
+            rdeps[name];
+            for (const auto& d : rec.depends)
+                rdeps[d].insert(name);
+        }
+
+        if (!success) {
+            printerr(color::ERROR, "Failed to export the database.");
+            return false;
+        }
+
+        quickdb::write("conflicts", conflicts);
+        quickdb::write("rdeps", rdeps);
+
+        unload();
+        rm(db_filename());
+        printerr(color::INFO, "Exported {} packages to '{}'.", db.size(), pkgdir);
+        return true;
+    }
+}
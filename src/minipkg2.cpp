@@ -1,3 +1,7 @@
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <sstream>
 #include "minipkg2.hpp"
 #include "utils.hpp"
 #include "print.hpp"
@@ -55,7 +59,41 @@ namespace minipkg2 {
     }
 
 
+    // An in-memory file containing the output of `config --dump`.
+    // It is inherited by the children, so env.bash doesn't have to run minipkg2 again.
+    static int create_config_fd() {
+        const int fd = ::memfd_create("minipkg2.conf", 0);
+        if (fd < 0) {
+            printerr(color::DEBUG, "memfd_create() failed, env.bash will run '{} config --dump'.", self);
+            return fd;
+        }
+
+        std::ostringstream stream{};
+        miniconf::dump(stream, config);
+        const auto str = stream.str();
+        if (::write(fd, str.data(), str.size()) != static_cast<::ssize_t>(str.size())) {
+            xclose(fd);
+            return -1;
+        }
+        return fd;
+    }
+    static int config_fd() {
+        // Builds may be started from several threads.
+        static const int fd = create_config_fd();
+        return fd;
+    }
+    void add_script_environ(std::vector<char*>& env) {
+        add_environ(env, "ROOT",        rootdir);
+        add_environ(env, "ENV_FILE",    env_filename);
+        add_environ(env, "MINIPKG2",    self);
+        if (const int fd = config_fd(); fd >= 0)
+            add_environ(env, "MINIPKG2_CONFIG_FD", std::to_string(fd));
+    }
+
     bool init_self() {
+        // Don't pick up the descriptor of a parent minipkg2.
+        ::unsetenv("MINIPKG2_CONFIG_FD");
+
         try {
             self = xreadlink("/proc/self/exe");
         } catch (const std::runtime_error& e) {
@@ -0,0 +1,44 @@
+#include "minipkg2.hpp"
+#include "cmdline.hpp"
+#include "localdb.hpp"
+#include "print.hpp"
+
+namespace minipkg2::cmdline::operations {
+    struct db_operation : operation {
+        db_operation()
+            : operation{
+                "db",
+                " [options]",
+                "Manage the database of installed packages.",
+                {
+                    {option::BASIC, "--migrate",    "Convert the package directories into local.db.",   {}, false },
+                    {option::BASIC, "--export",     "Convert local.db back into package directories.",  {}, false },
+                }
+            } {}
+        int operator()(const std::vector<std::string>& args) override;
+    };
+    static db_operation op_db;
+    operation* db = &op_db;
+
+    int db_operation::operator()(const std::vector<std::string>&) {
+        const bool opt_migrate  = is_set("--migrate");
+        const bool opt_export   = is_set("--export");
+
+        if (opt_migrate && opt_export) {
+            printerr(color::ERROR, "Options --migrate and --export are incompatible.");
+            return 1;
+        }
+
+        if (opt_migrate)
+            return !localdb::migrate();
+        if (opt_export)
+            return !localdb::export_files();
+
+        if (localdb::enabled()) {
+            printerr(color::INFO, "Using '{}/local.db' ({} packages).", dbdir, localdb::packages().size());
+        } else {
+            printerr(color::INFO, "Using package directories in '{}'.", pkgdir);
+        }
+        return 0;
+    }
+}
@@ -16,6 +16,7 @@ namespace minipkg2::cmdline::operations {
                     {option::ALIAS, "--yes",            {},                                     "-y",   false },
                     {option::BASIC, "--deps",           "Also download the dependencis.",       {},     false },
                     {option::BASIC, "--skip-installed", "Skip installed packages.",             {},     false },
+                    {option::BASIC, "--revalidate",     "Download files again, if they changed.", {},   false },
                 }
             } {}
         int operator()(const std::vector<std::string>& args) override;
@@ -27,6 +28,7 @@ namespace minipkg2::cmdline::operations {
         const bool opt_yes  = is_set("-y");
         const bool opt_deps = is_set("--deps");
         const bool opt_skip = is_set("--skip-installed");
+        const bool opt_revalidate = is_set("--revalidate");
 
         if (args.empty()) {
             printerr(color::ERROR, "At least 1 argument expected.");
@@ -52,6 +54,6 @@ namespace minipkg2::cmdline::operations {
 
         printerr(color::LOG, "Downloading sources...");
 
-        return !source_package::download(pkgs);
+        return !source_package::download(pkgs, opt_revalidate ? download_policy::REVALIDATE : download_policy::DEFAULT);
     }
 }
@@ -1,6 +1,12 @@
 #include "minipkg2.hpp"
 #include "cmdline.hpp"
+#include "scheduler.hpp"
+#include "buildstats.hpp"
+#include "depgraph.hpp"
+#include "jobserver.hpp"
+#include "parser.hpp"
 #include "package.hpp"
+#include "quickdb.hpp"
 #include "utils.hpp"
 #include "print.hpp"
 
@@ -19,6 +25,10 @@ namespace minipkg2::cmdline::operations {
                     { option::BASIC, "-s",              "Skip installed packages.",         {},     false },
                     { option::ALIAS, "--skip-installed",{},                                 "-s",   false },
                     { option::BASIC, "--force",         "Don't check for conflicts.",       {},     false },
+                    { option::ARG,   "--slots",         "Build up to N packages at once.",  {},     false },
+                    { option::BASIC, "--keep-going",    "Continue with independent packages after a failure.", {}, false },
+                    { option::BASIC, "--explain-schedule", "Print the predicted build schedule and exit.", {}, false },
+                    { option::BASIC, "--asdeps",        "Don't mark the packages as explicitly installed.", {}, false },
                 }
             } {}
         int operator()(const std::vector<std::string>& args) override;
@@ -26,12 +36,158 @@ namespace minipkg2::cmdline::operations {
     static install_operation op_install{};
     operation* install = &op_install;
 
+    static std::size_t parse_count(const std::string& str) {
+        char* endp;
+        const unsigned long n = std::strtoul(str.c_str(), &endp, 10);
+        return *endp == '\0' ? n : 0;
+    }
+
+    // The number of jobs shared by all builds (-j, or build.jobs).
+    static std::size_t build_jobs() {
+        if (jobs != 0)
+            return jobs;
+        const auto it = minipkg2::config.find("build.jobs");
+        if (it == minipkg2::config.end())
+            return 1;
+        if (it->second == "max")
+            return parser::concurrency();
+        return std::max<std::size_t>(parse_count(it->second), 1);
+    }
+
+    // A package can be built, once its build-dependencies and their runtime-dependencies are installed.
+    // Throws an exception that shows the path of a cycle.
+    static std::vector<scheduler::task> make_tasks(const depgraph::graph& graph) {
+        std::vector<scheduler::task> tasks(graph.nodes.size());
+        for (std::size_t i = 0; i < graph.nodes.size(); ++i) {
+            std::vector<bool> seen(graph.nodes.size(), false);
+            std::vector<std::size_t> stack{graph.nodes[i].bdepends};
+            while (!stack.empty()) {
+                const auto j = stack.back();
+                stack.pop_back();
+                if (seen[j] || j == i)
+                    continue;
+                seen[j] = true;
+                tasks[i].waits.push_back(j);
+                stack.insert(end(stack), begin(graph.nodes[j].rdepends), end(graph.nodes[j].rdepends));
+            }
+        }
+
+        // A build-dependency can need a runtime-dependency of a package, that can only be built after it:
+        // A bdepends B, B bdepends C, C rdepends A. Such tasks could never be started.
+        enum class mark { NEW, ACTIVE, DONE };
+        std::vector<mark> marks(tasks.size(), mark::NEW);
+        std::vector<std::pair<std::size_t, std::size_t>> stack{};
+        for (std::size_t root = 0; root < tasks.size(); ++root) {
+            if (marks[root] != mark::NEW)
+                continue;
+            marks[root] = mark::ACTIVE;
+            stack.emplace_back(root, 0);
+            while (!stack.empty()) {
+                auto& [i, pos] = stack.back();
+                if (pos == tasks[i].waits.size()) {
+                    marks[i] = mark::DONE;
+                    stack.pop_back();
+                    continue;
+                }
+
+                const auto w = tasks[i].waits[pos++];
+                if (marks[w] == mark::NEW) {
+                    marks[w] = mark::ACTIVE;
+                    stack.emplace_back(w, 0);
+                } else if (marks[w] == mark::ACTIVE) {
+                    std::string path{};
+                    auto it = std::find_if(begin(stack), end(stack), [w](const auto& f) { return f.first == w; });
+                    for (; it != end(stack); ++it)
+                        path += fmt::format("{} -> ", graph.nodes[it->first].pkg.name);
+                    path += graph.nodes[w].pkg.name;
+                    raise("Packages can't be built, because they wait for each other: {}", path);
+                }
+            }
+        }
+        return tasks;
+    }
+
+    // Predict the build duration of every package. Packages, that were never built, get the
+    // average of all known builds, or 1 second if there are no build stats at all.
+    static std::vector<double> estimate_durations(const std::vector<source_package>& pkgs) {
+        std::vector<double> durations{};
+        durations.reserve(pkgs.size());
+        for (const auto& pkg : pkgs)
+            durations.push_back(buildstats::estimate(pkg.name, pkg.version).value_or(1.0));
+        return durations;
+    }
+
+    // How many jobs every package can use: [jobs] <pkgname>=<n|max> in the config, or what was learned from previous builds.
+    static std::vector<std::size_t> estimate_parallelism(const std::vector<source_package>& pkgs) {
+        std::vector<std::size_t> result{};
+        result.reserve(pkgs.size());
+        for (const auto& pkg : pkgs) {
+            if (const auto it = minipkg2::config.find("jobs." + pkg.name); it != minipkg2::config.end()) {
+                result.push_back(it->second == "max" ? 0 : std::max<std::size_t>(parse_count(it->second), 1));
+            } else {
+                result.push_back(buildstats::parallelism(pkg.name, pkg.version).value_or(0));
+            }
+        }
+        return result;
+    }
+
+    static std::string fmt_duration(double seconds) {
+        const auto s = static_cast<long>(seconds + 0.5);
+        if (s < 60)
+            return fmt::format("{}s", s);
+        if (s < 3600)
+            return fmt::format("{}m{:02}s", s / 60, s % 60);
+        return fmt::format("{}h{:02}m", s / 3600, s / 60 % 60);
+    }
+
+    static void explain_schedule(const std::vector<source_package>& pkgs, const std::vector<scheduler::task>& tasks,
+                                 const scheduler::options& opts, const std::vector<double>& durations) {
+        const auto timeline = scheduler::simulate(tasks, opts, durations);
+        std::vector<std::size_t> order(pkgs.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(begin(order), end(order), [&](std::size_t a, std::size_t b) {
+            return timeline[a].start < timeline[b].start;
+        });
+
+        double makespan = 0.0;
+        printerr(color::LOG, "Predicted schedule ({} slot(s)):", opts.slots);
+        for (const auto i : order) {
+            const bool known = buildstats::lookup(pkgs[i].name, pkgs[i].version).has_value();
+            printerr(color::LOG, "  {:>7} - {:>7}  {:v}{}", fmt_duration(timeline[i].start), fmt_duration(timeline[i].end),
+                     pkgs[i], known ? "" : " (estimated)");
+            makespan = std::max(makespan, timeline[i].end);
+        }
+        printerr(color::LOG, "Predicted makespan: {}", fmt_duration(makespan));
+    }
+
     int install_operation::operator()(const std::vector<std::string>& args) {
         const bool opt_yes      = is_set("-y");
         const bool opt_clean    = is_set("--clean");
         const bool opt_no_deps  = is_set("--no-deps");
         const bool opt_skip     = is_set("-s");
         const bool opt_force    = is_set("--force");
+        const bool opt_explain  = is_set("--explain-schedule");
+        const bool opt_asdeps   = is_set("--asdeps");
+
+        scheduler::options sched_opts{};
+        sched_opts.keep_going = is_set("--keep-going");
+        if (const auto& opt = get_option("--slots")) {
+            sched_opts.slots = parse_count(opt.value);
+        } else if (const auto it = minipkg2::config.find("build.slots"); it != minipkg2::config.end()) {
+            sched_opts.slots = parse_count(it->second);
+        }
+        if (sched_opts.slots == 0) {
+            printerr(color::ERROR, "Invalid number of build slots.");
+            return 1;
+        }
+
+        // Every running build needs at least one job.
+        const auto num_jobs = build_jobs();
+        if (sched_opts.slots > num_jobs) {
+            printerr(color::DEBUG, "Limiting the build slots to {} job(s).", num_jobs);
+            sched_opts.slots = num_jobs;
+        }
 
         if (args.empty()) {
             printerr(color::ERROR, "At least 1 argument expected.");
@@ -40,7 +196,9 @@ namespace minipkg2::cmdline::operations {
 
         printerr(color::LOG, "Resolving packages...");
         const auto skip_policy = opt_skip ? resolve_skip_policy::ALWAYS : resolve_skip_policy::DEPEND;
-        const auto pkgs = source_package::resolve(args, !opt_no_deps, skip_policy);
+        auto graph = depgraph::resolve(args, !opt_no_deps, skip_policy);
+        const auto tasks = make_tasks(graph);
+        const auto pkgs = std::move(graph).packages();
 
         if (pkgs.empty()) {
             printerr(color::LOG, "Nothing done.");
@@ -65,6 +223,17 @@ namespace minipkg2::cmdline::operations {
         printerr(color::LOG, "Packages ({}){}", pkgs.size(), make_pkglist(pkgs));
         printerr(color::LOG, "");
 
+        // Start the packages on the longest path through the dependency graph first.
+        const auto durations = estimate_durations(pkgs);
+        sched_opts.priority = scheduler::critical_path(tasks, durations);
+        sched_opts.jobs = num_jobs;
+        sched_opts.parallelism = estimate_parallelism(pkgs);
+
+        if (opt_explain) {
+            explain_schedule(pkgs, tasks, sched_opts, durations);
+            return 0;
+        }
+
         if (!opt_yes) {
             if (!yesno("Proceed with download?", true))
                 return 1;
@@ -78,37 +247,77 @@ namespace minipkg2::cmdline::operations {
             }
         }
 
-        printerr(color::LOG, "Downloading sources...");
-        if (!source_package::download(pkgs))
-            return 1;
+        // Sources are downloaded while other packages are built, at most download.prefetch packages ahead.
+        // With 0, all sources are downloaded before anything is built.
+        sched_opts.prefetch = 8;
+        if (const auto it = minipkg2::config.find("download.prefetch"); it != minipkg2::config.end())
+            sched_opts.prefetch = parse_count(it->second);
+        if (sched_opts.prefetch == 0) {
+            printerr(color::LOG, "Downloading sources...");
+            if (!source_package::download(pkgs))
+                return 1;
+        }
 
         printerr(color::LOG, "");
         printerr(color::LOG, "Processing packages..");
 
-        for (std::size_t i = 0; i < transactions.size(); ++i) {
-            const auto& trans = transactions[i];
-            const auto& pkg = *trans.pkg;
-            printerr(color::LOG, "({}/{}) Building {:v}...", i+1, transactions.size(), pkg);
+        quickdb::transaction trans{};
+        std::vector<std::optional<binary_package>> binpkgs(transactions.size());
+        std::atomic<std::size_t> num_started{0};
+        std::size_t num_fetched = 0;
+        std::size_t num_installed = 0;
+
+        std::function<std::vector<bool>(const std::vector<std::size_t>&)> fetch{};
+        if (sched_opts.prefetch != 0) {
+            // The sources of all packages in the window share one download.
+            fetch = [&](const std::vector<std::size_t>& batch) {
+                std::vector<const source_package*> batch_pkgs{};
+                for (const auto i : batch) {
+                    batch_pkgs.push_back(transactions[i].pkg);
+                    printerr(color::LOG, "({}/{}) Downloading {:v}...", ++num_fetched, transactions.size(), *batch_pkgs.back());
+                }
+                return source_package::download(batch_pkgs);
+            };
+        }
+
+        const auto build = [&](std::size_t i, std::size_t num_jobs) {
+            const auto& pkg = *transactions[i].pkg;
+            const jobserver::slot slot{};
+            printerr(color::LOG, "({}/{}) Building {:v}...", ++num_started, transactions.size(), pkg);
+            printerr(color::DEBUG, "{}: Using {} job(s).", pkg.name, num_jobs);
             const auto path_binpkg = fmt::format("{0}/{1}-{2}/{1}:{2}.bmpkg.tar.gz", builddir, pkg.name, pkg.version);
             const auto filesdir = fmt::format("{}/{}/files", repodir, pkg.name);
 
-            const auto result = pkg.build(path_binpkg, filesdir);
-            if (!result.has_value()) {
-                return 1;
-            }
-            const auto binpkg = result.value();
-
-            for (std::size_t i = 0; i < trans.remove.size(); ++i) {
-                const auto& rmpkg = trans.remove[i];
-                printerr(color::LOG, "({}/{}) Removing {:v}...", i+1, trans.remove.size(), rmpkg);
+            // Concurrent builds must not mix their output.
+            auto binpkg = pkg.build(path_binpkg, filesdir, sched_opts.slots > 1, num_jobs);
+            if (!binpkg)
+                return false;
+            binpkgs[i].emplace(std::move(*binpkg));
+            return true;
+        };
+        const auto install = [&](std::size_t i) {
+            const auto& trans = transactions[i];
+            for (std::size_t j = 0; j < trans.remove.size(); ++j) {
+                const auto& rmpkg = trans.remove[j];
+                printerr(color::LOG, "({}/{}) Removing {:v}...", j+1, trans.remove.size(), rmpkg);
                 rmpkg.uninstall();
             }
 
-            printerr(color::LOG, "({}/{}) Installing {:v}...", i+1, transactions.size(), binpkg.pkg);
-            binpkg.install();
-        }
-
+            const auto& binpkg = binpkgs[i].value();
+            printerr(color::LOG, "({}/{}) Installing {:v}...", ++num_installed, transactions.size(), binpkg.pkg);
+            // Packages that were only pulled in as dependencies can be removed later by `remove --orphans`.
+            const auto& pkg = *trans.pkg;
+            const bool is_explicit = !opt_asdeps && std::any_of(begin(args), end(args), [&pkg](const std::string& a) {
+                return pkg.is_provider_of(a);
+            });
+            return binpkg.install(opt_force, is_explicit);
+        };
 
+        jobserver::start(num_jobs, sched_opts.slots);
+        const bool success = scheduler::run(tasks, sched_opts, fetch, build, install);
+        jobserver::stop();
+        if (!trans.commit() || !success)
+            return 1;
         return 0;
     }
 }
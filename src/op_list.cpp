@@ -1,7 +1,8 @@
-#include <unistd.h>
 #include "minipkg2.hpp"
 #include "package.hpp"
 #include "cmdline.hpp"
+#include "upgrade.hpp"
+#include "orphans.hpp"
 #include "print.hpp"
 #include "utils.hpp"
 
@@ -17,6 +18,7 @@ namespace minipkg2::cmdline::operations {
                     {option::BASIC, "--local",      "List installed packages.",             {}, false },
                     {option::BASIC, "--files",      "List files of installed packages.",    {}, false },
                     {option::BASIC, "--upgradable", "List upgradable packages.",            {}, false },
+                    {option::BASIC, "--orphans",    "List packages that are no longer needed.", {}, false },
                 }
             } {}
         int operator()(const std::vector<std::string>& args) override;
@@ -29,6 +31,7 @@ namespace minipkg2::cmdline::operations {
         const bool opt_local        = is_set("--local");
         const bool opt_files        = is_set("--files");
         const bool opt_upgradable   = is_set("--upgradable");
+        const bool opt_orphans      = is_set("--orphans");
 
         if (opt_repo && opt_local) {
             printerr(color::ERROR, "Either --repo or --local must be selected.");
@@ -45,6 +48,11 @@ namespace minipkg2::cmdline::operations {
             return 1;
         }
 
+        if (opt_orphans && (opt_files || opt_repo || opt_upgradable)) {
+            printerr(color::ERROR, "Option --orphans is incompatible with --repo, --files and --upgradable.");
+            return 1;
+        }
+
         if (opt_files && args.size() == 0) {
             printerr(color::ERROR, "Option --files expects 1 or more arguments.");
             return 1;
@@ -58,24 +66,31 @@ namespace minipkg2::cmdline::operations {
         } else {
             if (opt_files) {
                 for (const auto& name : args) {
-                    const auto path = fmt::format("{}/{}/files", pkgdir, name);
-                    if (::access(path.c_str(), R_OK) != 0) {
+                    if (!installed_package::is_installed(name)) {
                         printerr(color::ERROR, "Invalid package: {}.", name);
                         return 1;
                     }
-                    cat(stdout, path);
+                    for (const auto& file : installed_package::get_files(name))
+                        fmt::print("{}\n", file);
                 }
                 return 0;
             }
 
-            const auto& pkgs = installed_package::parse_local();
+            if (opt_orphans) {
+                for (const auto& name : orphans::sweep())
+                    fmt::print("{}\n", name);
+                return 0;
+            }
 
             if (opt_upgradable) {
-                printerr(color::ERROR, "Unsupported option: --upgradable");
-            } else {
-                for (const auto& pkg : pkgs) {
-                    fmt::print("{} {}\n", pkg.name, pkg.version);
-                }
+                for (const auto& c : upgrade::find_upgradable(args))
+                    fmt::print("{} {} -> {}\n", c.name, c.installed_version, c.repo_version);
+                return 0;
+            }
+
+            const auto& pkgs = installed_package::parse_local();
+            for (const auto& pkg : pkgs) {
+                fmt::print("{} {}\n", pkg.name, pkg.version);
             }
         }
         return 0;
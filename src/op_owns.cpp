@@ -0,0 +1,53 @@
+#include <unistd.h>
+#include <climits>
+#include "fileindex.hpp"
+#include "minipkg2.hpp"
+#include "cmdline.hpp"
+#include "print.hpp"
+#include "utils.hpp"
+
+namespace minipkg2::cmdline::operations {
+    struct owns_operation : operation {
+        owns_operation()
+            : operation{
+                "owns",
+                " <path(s)>",
+                "Find the packages that own files.",
+                {}
+            } {}
+        int operator()(const std::vector<std::string>& args) override;
+    };
+    static owns_operation op_owns;
+    operation* owns = &op_owns;
+
+    int owns_operation::operator()(const std::vector<std::string>& args) {
+        if (args.empty()) {
+            printerr(color::ERROR, "At least 1 argument expected.");
+            return 1;
+        }
+
+        int ec = 0;
+        for (const auto& arg : args) {
+            std::string path = arg;
+            if (path.front() != '/') {
+                char cwd[PATH_MAX];
+                if (::getcwd(cwd, sizeof cwd) != nullptr)
+                    path = fmt::format("{}/{}", cwd, path);
+            }
+
+            // Paths inside of --root are relative to the root.
+            if (!rootdir.empty() && starts_with(path, rootdir + '/'))
+                path.erase(0, rootdir.size());
+
+            const auto owners = fileindex::owners(path);
+            if (owners.empty()) {
+                printerr(color::ERROR, "'{}' is not owned by any package.", path);
+                ec = 1;
+                continue;
+            }
+            for (const auto& name : owners)
+                fmt::print("{} is owned by {}\n", path, name);
+        }
+        return ec;
+    }
+}
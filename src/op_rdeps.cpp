@@ -0,0 +1,70 @@
+#include "pkggraph.hpp"
+#include "cmdline.hpp"
+#include "print.hpp"
+
+namespace minipkg2::cmdline::operations {
+    struct rdeps_operation : operation {
+        rdeps_operation()
+            : operation{
+                "rdeps",
+                " [options] <package(s)>",
+                "List installed packages that depend on packages.",
+                {
+                    {option::BASIC, "-t",           "Also list indirect reverse-dependencies.",     {}, false},
+                    {option::ALIAS, "--transitive", {},                                             "-t", false},
+                    {option::BASIC, "--dot",        "Print the dependencies as a graph in the DOT format.", {}, false},
+                }
+            } {}
+        int operator()(const std::vector<std::string>& args) override;
+    };
+    static rdeps_operation op_rdeps;
+    operation* rdeps = &op_rdeps;
+
+    int rdeps_operation::operator()(const std::vector<std::string>& args) {
+        using pkggraph::node;
+        const bool opt_transitive   = is_set("-t");
+        const bool opt_dot          = is_set("--dot");
+
+        if (args.empty()) {
+            printerr(color::ERROR, "At least 1 argument expected.");
+            return 1;
+        }
+
+        const auto& g = pkggraph::load();
+        std::vector<node> targets{};
+        for (const auto& name : args) {
+            const auto n = g.find(name);
+            if (!n) {
+                printerr(color::ERROR, "Package '{}' is not installed.", name);
+                return 1;
+            }
+            targets.push_back(*n);
+        }
+
+        const auto result = pkggraph::reverse_dependencies(g, targets, opt_transitive);
+        if (!opt_dot) {
+            // Closer reverse-dependencies come first.
+            for (const auto& [n, _] : result)
+                fmt::print("{}\n", g.names[n]);
+            return 0;
+        }
+
+        // Draw every dependency between the listed packages, not only the ones they were found through.
+        std::vector<bool> listed(g.size(), false);
+        for (const auto n : targets)
+            listed[n] = true;
+        for (const auto& [n, _] : result)
+            listed[n] = true;
+
+        std::vector<std::pair<node, node>> edges{};
+        for (const auto& [n, _] : result) {
+            const auto [begin, end] = g.dependencies(n);
+            for (auto it = begin; it != end; ++it) {
+                if (listed[*it])
+                    edges.emplace_back(n, *it);
+            }
+        }
+        pkggraph::write_dot(stdout, g, edges);
+        return 0;
+    }
+}
@@ -1,5 +1,7 @@
 #include "cmdline.hpp"
 #include "package.hpp"
+#include "localdb.hpp"
+#include "orphans.hpp"
 #include "quickdb.hpp"
 #include "print.hpp"
 #include "utils.hpp"
@@ -15,6 +17,9 @@ namespace minipkg2::cmdline::operations {
                     {option::BASIC, "-y",           "Don't ask for confirmation.",          {}, false},
                     {option::ALIAS, "--yes",        {},                                     "-y", false},
                     {option::BASIC, "--purge",      "Purge the package.",                   {}, false},
+                    {option::BASIC, "-r",           "Also remove dependencies that are no longer needed.", {}, false},
+                    {option::ALIAS, "--recursive",  {},                                     "-r", false},
+                    {option::BASIC, "--orphans",    "Remove all packages that are no longer needed.", {}, false},
                 }
             } {}
         int operator()(const std::vector<std::string>& args) override;
@@ -25,29 +30,52 @@ namespace minipkg2::cmdline::operations {
     int remove_operation::operator()(const std::vector<std::string>& args) {
         const bool opt_yes      = is_set("-y");
         const bool opt_purge    = is_set("--purge");
+        const bool opt_recursive= is_set("-r");
+        const bool opt_orphans  = is_set("--orphans");
 
-        if (args.empty()) {
+        if (opt_orphans && !args.empty()) {
+            printerr(color::ERROR, "Option --orphans doesn't expect any arguments.");
+            return 1;
+        }
+        if (args.empty() && !opt_orphans) {
             printerr(color::ERROR, "At least 1 argument expected.");
             return 1;
         }
 
         printerr(color::LOG, "Resolving packages...");
-        auto pkgs = installed_package::resolve(args);
+        auto names = args;
+        if (opt_recursive || opt_orphans) {
+            for (auto& name : orphans::sweep(args)) {
+                if (!contains(names, name)) {
+                    printerr(color::INFO, "Package '{}' is no longer needed.", name);
+                    names.push_back(std::move(name));
+                }
+            }
+            if (names.empty()) {
+                printerr(color::LOG, "Nothing to do.");
+                return 0;
+            }
+        }
+        auto pkgs = installed_package::resolve(names);
 
         if (!opt_purge) {
             printerr(color::LOG, "Checking for reverse-dependencies...");
-            auto db = quickdb::read("rdeps");
             bool success = true;
             for (const auto& pkg : pkgs) {
-                const auto check = [&db, &success, &args](const std::string& name) {
-                    auto it = db.find(name);
-                    if (it != db.end() && !it->second.empty()) {
-                        for (const auto& x : it->second) {
-                            if (!contains(args, x)) {
-                                printerr(color::ERROR, "Package '{}' depends on '{}'.", x, name);
-                                success = false;
-                            }
+                const auto check = [&success, &names](const std::string& name) {
+                    const auto report = [&](std::string_view x) {
+                        if (!contains(names, x)) {
+                            printerr(color::ERROR, "Package '{}' depends on '{}'.", x, name);
+                            success = false;
                         }
+                    };
+                    // local.db has its own index of reverse-dependencies.
+                    if (localdb::enabled()) {
+                        for (const auto& x : localdb::rdeps(name))
+                            report(x);
+                    } else {
+                        for (const auto x : quickdb::lookup("rdeps", name))
+                            report(x);
                     }
                 };
                 check(pkg.name);
@@ -59,7 +87,7 @@ namespace minipkg2::cmdline::operations {
         }
 
         printerr(color::LOG, "Estimating size...");
-        const auto size = installed_package::estimate_size(args);
+        const auto size = installed_package::estimate_size(names);
 
         printerr(color::LOG, "");
         printerr(color::LOG, "Packages ({}){}", pkgs.size(), make_pkglist(pkgs));
@@ -73,6 +101,7 @@ namespace minipkg2::cmdline::operations {
         }
         printerr(color::LOG, "Processing packages..");
 
+        quickdb::transaction trans{};
         for (std::size_t i = 0; i < pkgs.size(); ++i) {
             const auto& pkg = pkgs[i];
             printerr(color::LOG, "({}/{}) Purging {:v}...", i+1, pkgs.size(), pkg);
@@ -81,6 +110,6 @@ namespace minipkg2::cmdline::operations {
                 return 1;
             }
         }
-        return 0;
+        return trans.commit() ? 0 : 1;
     }
 }
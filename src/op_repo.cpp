@@ -1,7 +1,12 @@
 #include <unistd.h>
+#include <cstdlib>
+#include <cstdio>
+#include <map>
 #include "minipkg2.hpp"
 #include "cmdline.hpp"
+#include "package.hpp"
 #include "utils.hpp"
+#include "repoindex.hpp"
 #include "print.hpp"
 #include "git.hpp"
 
@@ -14,8 +19,12 @@ namespace minipkg2::cmdline::operations {
                 "Manage the repository.",
                 {
                     {option::ARG,   "--init",   "Initialize the repository.",       {}, false },
+                    {option::ARG,   "--depth",  "Only fetch the last N commits on --init.", {}, false },
+                    {option::ARG,   "--filter", "Make a partial clone on --init (e.g. blob:none).", {}, false },
                     {option::BASIC, "--sync",   "Synchronize the repository.",      {}, false },
+                    {option::BASIC, "--changes", "Print the packages changed by the last --sync.", {}, false },
                     {option::ARG,   "--branch", "Change to a different branch.",    {}, false },
+                    {option::BASIC, "--verify-parser", "Compare the native parser with parse.bash.", {}, false },
                 }
             } {}
         int operator()(const std::vector<std::string>& args) override;
@@ -23,7 +32,68 @@ namespace minipkg2::cmdline::operations {
     static repo_operation op_repo;
     operation* repo = &op_repo;
 
+    // The packages changed by the last sync, one "<A|M|D> <name>" per line.
+    static std::string changes_filename() {
+        return dbdir + "/repo.changes";
+    }
+
+    // Map the changed files to the package directories they belong to.
+    static std::map<std::string, char> changed_packages(const std::vector<git::change>& changes) {
+        std::map<std::string, char> pkgs{};
+        for (const auto& c : changes) {
+            const auto slash = c.path.find('/');
+            if (slash == std::string::npos)
+                continue;
+
+            auto& status = pkgs.emplace(c.path.substr(0, slash), 'M').first->second;
+            if (c.path.compare(slash + 1, std::string::npos, "package.build") == 0 && c.status != 'M')
+                status = c.status;
+        }
+        return pkgs;
+    }
+
+    static bool write_changes(const std::map<std::string, char>& pkgs) {
+        const auto filename = changes_filename();
+        const auto tmpname = filename + ".tmp";
+        std::FILE* file = std::fopen(tmpname.c_str(), "w");
+        if (!file)
+            return false;
+        for (const auto& [name, status] : pkgs)
+            fmt::print(file, "{} {}\n", status, name);
+        if (std::fclose(file) != 0 || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+            rm(tmpname);
+            return false;
+        }
+        return true;
+    }
+
+    static int sync() {
+        const auto changes = git::fast_forward(repodir);
+        if (!changes) {
+            printerr(color::ERROR, "Failed to sync repo.");
+            return 1;
+        }
+
+        const auto pkgs = changed_packages(*changes);
+        std::vector<std::string> names{};
+        for (const auto& [name, status] : pkgs) {
+            names.push_back(name);
+            printerr(color::LOG, "{} {}", status == 'A' ? "New:    " : status == 'D' ? "Removed:" : "Updated:", name);
+        }
+        if (pkgs.empty())
+            printerr(color::INFO, "Repo is up to date.");
+
+        repoindex::invalidate(names);
+        repoindex::save();
+        if (!write_changes(pkgs))
+            printerr(color::WARN, "Failed to write '{}'.", changes_filename());
+        return 0;
+    }
+
     int repo_operation::operator()(const std::vector<std::string>&) {
+        if (is_set("--verify-parser"))
+            return !source_package::verify_native_parser();
+
         std::string version = git::version();
         if (version.empty()) {
             printerr(color::ERROR, "Runtime dependency 'git' is not installed.");
@@ -31,8 +101,19 @@ namespace minipkg2::cmdline::operations {
         }
 
         if (const auto& opt = get_option("--init")) {
+            std::size_t depth = 0;
+            if (const auto& depth_opt = get_option("--depth")) {
+                char* endp;
+                depth = std::strtoul(depth_opt.value.c_str(), &endp, 10);
+                if (*endp != '\0' || depth == 0) {
+                    printerr(color::ERROR, "Invalid depth '{}'.", depth_opt.value);
+                    return 1;
+                }
+            }
+
             rm_rf(repodir);
-            if (!git::clone(opt.value, repodir, get_option("--branch").value)) {
+            rm(changes_filename());
+            if (!git::clone(opt.value, repodir, get_option("--branch").value, depth, get_option("--filter").value)) {
                 printerr(color::ERROR, "Failed to initialize repo.");
                 return 1;
             }
@@ -44,11 +125,17 @@ namespace minipkg2::cmdline::operations {
             return 1;
         }
 
-        if (is_set("--sync")) {
-            if (!git::pull(repodir)) {
-                printerr(color::ERROR, "Failed to sync repo.");
-                return 1;
-            }
+        if (is_set("--sync"))
+            return sync();
+
+        if (is_set("--changes")) {
+            std::FILE* file = std::fopen(changes_filename().c_str(), "r");
+            if (!file)
+                return 0;
+            std::string line{};
+            while (freadline(file, line))
+                fmt::print("{}\n", line);
+            std::fclose(file);
             return 0;
         }
 
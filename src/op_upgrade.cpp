@@ -0,0 +1,70 @@
+#include "cmdline.hpp"
+#include "package.hpp"
+#include "upgrade.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::cmdline::operations {
+    struct upgrade_operation : operation {
+        upgrade_operation()
+            : operation{
+                "upgrade",
+                " [options] [package(s)]",
+                "Rebuild packages that have a newer version in the repo.",
+                {
+                    { option::BASIC, "-y",              "Don't ask for confirmation.",      {},     false },
+                    { option::ALIAS, "--yes",           {},                                 "-y",   false },
+                    { option::BASIC, "--no-rdeps",      "Don't rebuild reverse-dependencies.", {},  false },
+                    { option::ARG,   "--slots",         "Build up to N packages at once.",  {},     false },
+                    { option::BASIC, "--keep-going",    "Continue with independent packages after a failure.", {}, false },
+                    { option::BASIC, "--explain-schedule", "Print the predicted build schedule and exit.", {}, false },
+                }
+            } {}
+        int operator()(const std::vector<std::string>& args) override;
+    };
+    static upgrade_operation op_upgrade;
+    operation* upgrade = &op_upgrade;
+
+    int upgrade_operation::operator()(const std::vector<std::string>& args) {
+        const bool opt_no_rdeps = is_set("--no-rdeps");
+
+        for (const auto& name : args) {
+            if (!installed_package::is_installed(name)) {
+                printerr(color::ERROR, "Package '{}' is not installed.", name);
+                return 1;
+            }
+        }
+
+        printerr(color::LOG, "Checking for upgrades...");
+        const auto candidates = minipkg2::upgrade::find_upgradable(args);
+        if (candidates.empty()) {
+            printerr(color::LOG, "Nothing to do.");
+            return 0;
+        }
+
+        std::vector<std::string> names{};
+        for (const auto& c : candidates) {
+            printerr(color::LOG, "{} {} -> {}", c.name, c.installed_version, c.repo_version);
+            names.push_back(c.name);
+        }
+
+        // Packages that were built against an old version.
+        if (!opt_no_rdeps) {
+            for (const auto& name : minipkg2::upgrade::reverse_dependencies(names)) {
+                printerr(color::LOG, "{} (rebuild)", name);
+                names.push_back(name);
+            }
+        }
+        printerr(color::LOG, "");
+
+        // The build order is determined by `install`.
+        for (const auto opt : { "-y", "--keep-going", "--explain-schedule" })
+            install->get_option(opt).selected = is_set(opt);
+        // Rebuilt packages keep their install reason.
+        install->get_option("--asdeps").selected = true;
+        auto& slots = install->get_option("--slots");
+        slots.selected = get_option("--slots").selected;
+        slots.value = get_option("--slots").value;
+        return (*install)(names);
+    }
+}
@@ -0,0 +1,63 @@
+#include "pkggraph.hpp"
+#include "cmdline.hpp"
+#include "print.hpp"
+
+namespace minipkg2::cmdline::operations {
+    struct why_operation : operation {
+        why_operation()
+            : operation{
+                "why",
+                " [options] <package(s)>",
+                "Show why packages are installed.",
+                {
+                    {option::BASIC, "--dot",    "Print the chains as a graph in the DOT format.",   {}, false},
+                }
+            } {}
+        int operator()(const std::vector<std::string>& args) override;
+    };
+    static why_operation op_why;
+    operation* why = &op_why;
+
+    int why_operation::operator()(const std::vector<std::string>& args) {
+        const bool opt_dot = is_set("--dot");
+
+        if (args.empty()) {
+            printerr(color::ERROR, "At least 1 argument expected.");
+            return 1;
+        }
+
+        const auto& g = pkggraph::load();
+        std::vector<std::pair<pkggraph::node, pkggraph::node>> edges{};
+        int ec = 0;
+        for (const auto& name : args) {
+            const auto n = g.find(name);
+            if (!n) {
+                printerr(color::ERROR, "Package '{}' is not installed.", name);
+                ec = 1;
+                continue;
+            }
+
+            const auto chain = pkggraph::why(g, *n);
+            if (chain.empty()) {
+                printerr(color::WARN, "Package '{}' is not needed by any explicitly installed package.", name);
+                continue;
+            }
+
+            if (opt_dot) {
+                for (std::size_t i = 1; i < chain.size(); ++i)
+                    edges.emplace_back(chain[i - 1], chain[i]);
+            } else if (chain.size() == 1) {
+                fmt::print("{} is installed explicitly\n", g.names[*n]);
+            } else {
+                fmt::print("{}", g.names[chain.front()]);
+                for (std::size_t i = 1; i < chain.size(); ++i)
+                    fmt::print(" -> {}", g.names[chain[i]]);
+                fmt::print("\n");
+            }
+        }
+
+        if (opt_dot)
+            pkggraph::write_dot(stdout, g, edges);
+        return ec;
+    }
+}
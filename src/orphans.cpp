@@ -0,0 +1,60 @@
+#include <algorithm>
+#include "pkggraph.hpp"
+#include "orphans.hpp"
+
+namespace minipkg2::orphans {
+    std::vector<std::string> sweep(const std::vector<std::string>& removed) {
+        using pkggraph::node;
+        const auto& g = pkggraph::load();
+
+        std::vector<bool> excluded(g.size(), false);
+        for (const auto& name : removed) {
+            if (const auto n = g.find(name))
+                excluded[*n] = true;
+        }
+
+        // Mark everything that can be reached from `roots`.
+        const auto mark = [&](std::vector<node> stack) {
+            std::vector<bool> marked(g.size(), false);
+            while (!stack.empty()) {
+                const auto i = stack.back();
+                stack.pop_back();
+                if (marked[i])
+                    continue;
+                marked[i] = true;
+                const auto [begin, end] = g.dependencies(i);
+                for (auto it = begin; it != end; ++it) {
+                    if (!excluded[*it])
+                        stack.push_back(*it);
+                }
+            }
+            return marked;
+        };
+
+        std::vector<node> roots{};
+        for (node i = 0; i < g.size(); ++i) {
+            if (g.is_explicit[i] && !excluded[i])
+                roots.push_back(i);
+        }
+        const auto needed = mark(roots);
+
+        // With `removed`, only its own dependencies are swept.
+        std::vector<bool> candidates(g.size(), true);
+        if (!removed.empty()) {
+            std::vector<node> start{};
+            for (node i = 0; i < g.size(); ++i) {
+                if (excluded[i])
+                    start.push_back(i);
+            }
+            std::fill(begin(excluded), end(excluded), false);
+            candidates = mark(start);
+        }
+
+        std::vector<std::string> result{};
+        for (node i = 0; i < g.size(); ++i) {
+            if (!needed[i] && candidates[i])
+                result.push_back(g.names[i]);
+        }
+        return result;
+    }
+}
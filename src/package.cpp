@@ -6,11 +6,24 @@
 #include <fcntl.h>
 #include <spawn.h>
 #include <cassert>
+#include <chrono>
 #include <climits>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
 #include <map>
 #include "minipkg2.hpp"
+#include "buildstats.hpp"
+#include "download.hpp"
+#include "jobserver.hpp"
 #include "package.hpp"
+#include "repoindex.hpp"
+#include "localdb.hpp"
+#include "fileindex.hpp"
+#include "depgraph.hpp"
+#include "parser.hpp"
 #include "quickdb.hpp"
+#include "sha256.hpp"
 #include "utils.hpp"
 #include "print.hpp"
 #include "git.hpp"
@@ -53,6 +66,7 @@ namespace minipkg2 {
     void source_package::print() const {
         package_base::print();
         print_line("Sources",               begin(sources), end(sources));
+        print_line("SHA-256 Sums",          begin(sha256sums), end(sha256sums));
         print_line("Build Dependencies",    begin(bdepends), end(bdepends));
         print_line("Features",              begin(features), end(features));
     }
@@ -65,6 +79,7 @@ namespace minipkg2 {
         binary_package_info::print();
         const auto idate = uts_to_str(install_date);
         print_line("Install Date",          idate);
+        print_line("Install Reason",        reason == install_reason::EXPLICIT ? "explicit" : "dependency");
     }
 
 
@@ -85,6 +100,7 @@ namespace minipkg2 {
     bashconfig::config installed_package::to_config() const {
         auto conf = binary_package_info::to_config();
         conf["install_date"] = std::to_string(install_date);
+        conf["install_reason"] = reason == install_reason::EXPLICIT ? "explicit" : "dependency";
         return conf;
     }
 
@@ -96,6 +112,7 @@ namespace minipkg2 {
         std::string url;
         std::string description;
         std::vector<std::string> sources;
+        std::vector<std::string> sha256sums;
         std::vector<std::string> bdepends;
         std::vector<std::string> rdepends;
         std::set<std::string> provides;
@@ -103,67 +120,31 @@ namespace minipkg2 {
         std::vector<std::string> features;
         std::time_t build_date;
         std::time_t install_date;
+        std::string install_reason;
         std::string provided_by;
     };
-    static std::optional<generic_package> parse_generic(const std::string& filename) {
-        printerr(color::DEBUG, "Parsing '{}'...", filename);
-        if (::access(filename.c_str(), R_OK) != 0) {
-            printerr(color::DEBUG, "Cannot access '{}'.", filename);
-            return {};
-        }
-
-        int pipefd[2];
-        xpipe(pipefd);
-
-        // Construct the file descriptor description.
-        ::posix_spawn_file_actions_t actions;
-        ::posix_spawn_file_actions_init(&actions);
-        ::posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
-        ::posix_spawn_file_actions_addclose(&actions, pipefd[0]);
-        ::posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
-        ::posix_spawn_file_actions_addclose(&actions, pipefd[1]);
-
-        // Construct argv.
-        std::vector<char*> args{};
-        args.push_back(xstrdup("bash"));
-        args.push_back(xstrdup(parse_filename));
-        args.push_back(xstrdup(filename));
-        args.push_back(nullptr);
-
-        // Construct envp.
-        std::vector<char*> env = copy_environ();
-        add_environ(env, "ROOT",        rootdir);
-        add_environ(env, "ENV_FILE",    env_filename);
-        add_environ(env, "MINIPKG2",    self);
-        env.push_back(nullptr);
-
-        ::pid_t pid;
-        if (::posix_spawnp(&pid, "bash", &actions, nullptr, args.data(), env.data()) != 0)
-            raise("{}: parse(): Failed to posix_spawn() the shell.", filename);
-
-        // Cleanup.
-        xclose(pipefd[1]);
-        free_environ(args);
-        free_environ(env);
-        ::posix_spawn_file_actions_destroy(&actions);
-
-        // Read the package information.
-        std::FILE* file = ::fdopen(pipefd[0], "r");
-        if (!file)
-            raise("Failed to smoke on pipe.");
-
-        const auto read_set = [file] {
+    // Decode the record printed by parse.bash.
+    static generic_package decode_record(const std::string& filename, std::string_view record) {
+        const auto readline = [&record](std::string& line) {
+            if (record.empty())
+                return false;
+            const auto end = record.find('\n');
+            line = record.substr(0, end);
+            record.remove_prefix(end == std::string_view::npos ? record.size() : end + 1);
+            return true;
+        };
+        const auto read_set = [&readline] {
             std::set<std::string> lines{};
             std::string line;
-            while (freadline(file, line) && line != "--"sv) {
+            while (readline(line) && line != "--"sv) {
                 lines.insert(std::move(line));
             }
             return lines;
         };
-        const auto read_vec = [file] {
+        const auto read_vec = [&readline] {
             std::vector<std::string> lines{};
             std::string line;
-            while (freadline(file, line) && line != "--"sv) {
+            while (readline(line) && line != "--"sv) {
                 lines.push_back(std::move(line));
             }
             return lines;
@@ -172,35 +153,256 @@ namespace minipkg2 {
         // Parse the output.
         generic_package pkg;
         pkg.filename        = filename;
-        freadline(file, pkg.name);
-        freadline(file, pkg.version);
-        freadline(file, pkg.url);
-        freadline(file, pkg.description);
+        readline(pkg.name);
+        readline(pkg.version);
+        readline(pkg.url);
+        readline(pkg.description);
         pkg.sources         = read_vec();
+        pkg.sha256sums      = read_vec();
         pkg.bdepends        = read_vec();
         pkg.rdepends        = read_vec();
         pkg.provides        = read_set();
         pkg.conflicts       = read_set();
         pkg.features        = read_vec();
         std::string tmp;
-        freadline(file, tmp);
+        readline(tmp);
         pkg.build_date      = str_to_uts(tmp);
-        freadline(file, tmp);
+        readline(tmp);
         pkg.install_date    = str_to_uts(tmp);
+        readline(pkg.install_reason);
 
-        std::fclose(file);
+        return pkg;
+    }
+    static void set_provided_by(generic_package& pkg) {
+        struct ::stat st;
+        if (::lstat(pkg.filename.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+            pkg.provided_by = xreadlink(pkg.filename);
+        }
+    }
+    // A package that is being parsed.
+    struct parse_task {
+        std::string filename;
+        std::optional<std::string> name;            // Only set for repo packages.
+        std::optional<repoindex::stamp> stamp;      // Only set for repo packages.
+        std::optional<generic_package> result;
+        parser::job job;
+    };
+    static parse_task start_generic(const std::string& filename) {
+        parse_task task;
+        task.filename = filename;
+        task.job = parser::start(filename);
+        return task;
+    }
+    // Convert a package.info that was read by bashconfig::read(), the same way parse.bash would.
+    static generic_package config_to_generic(const std::string& filename, const bashconfig::config& conf) {
+        const auto get_str = [&conf](const char* name) -> std::string {
+            const auto it = conf.find(name);
+            if (it == conf.end())
+                return {};
+            if (const auto* str = std::get_if<std::string>(&it->second))
+                return *str;
+            const auto& vec = std::get<std::vector<std::string>>(it->second);
+            return vec.empty() ? std::string{} : vec.front();
+        };
+        const auto get_vec = [&conf](std::vector<std::string>& out, const char* name) {
+            const auto it = conf.find(name);
+            if (it == conf.end())
+                return;
+            if (const auto* str = std::get_if<std::string>(&it->second)) {
+                out.push_back(*str);
+            } else {
+                const auto& vec = std::get<std::vector<std::string>>(it->second);
+                out.insert(end(out), begin(vec), end(vec));
+            }
+        };
+        const auto get_set = [&get_vec](std::set<std::string>& out, const char* name) {
+            std::vector<std::string> tmp{};
+            get_vec(tmp, name);
+            out.insert(begin(tmp), end(tmp));
+        };
+
+        generic_package pkg;
+        pkg.filename        = filename;
+        pkg.name            = get_str("pkgname");
+        pkg.version         = get_str("pkgver");
+        pkg.url             = get_str("url");
+        pkg.description     = get_str("description");
+        get_vec(pkg.sources,    "sources");
+        get_vec(pkg.sha256sums, "sha256sums");
+        get_vec(pkg.bdepends,   "depends");
+        get_vec(pkg.bdepends,   "bdepends");
+        get_vec(pkg.rdepends,   "depends");
+        get_vec(pkg.rdepends,   "rdepends");
+        get_set(pkg.provides,   "provides");
+        get_set(pkg.conflicts,  "provides");
+        get_set(pkg.conflicts,  "conflicts");
+        get_vec(pkg.features,   "features");
+        pkg.build_date      = str_to_uts(get_str("build_date"));
+        pkg.install_date    = str_to_uts(get_str("install_date"));
+        pkg.install_reason  = get_str("install_reason");
+        return pkg;
+    }
+    // Same as start_generic(), but read files written by bashconfig::write_file() without spawning bash.
+    static parse_task start_generic_info(const std::string& filename) {
+        std::FILE* file = std::fopen(filename.c_str(), "r");
+        if (!file)
+            return start_generic(filename);
+
+        try {
+            const auto conf = bashconfig::read(file);
+            std::fclose(file);
+
+            parse_task task;
+            task.filename = filename;
+            task.result = config_to_generic(filename, conf);
+            set_provided_by(task.result.value());
+            return task;
+        } catch (const bashconfig::parse_error& e) {
+            std::fclose(file);
+            printerr(color::DEBUG, "{}: {}, falling back to bash.", filename, e.what());
+            return start_generic(filename);
+        }
+    }
+    // Encode a package the same way parse.bash prints it.
+    static std::string encode_record(const generic_package& pkg) {
+        std::string record{};
+        const auto line = [&record](std::string_view str) {
+            record += str;
+            record += '\n';
+        };
+        const auto list = [&line](const auto& container) {
+            for (const auto& x : container)
+                line(x);
+            line("--");
+        };
+        line(pkg.name);
+        line(pkg.version);
+        line(pkg.url);
+        line(pkg.description);
+        list(pkg.sources);
+        list(pkg.sha256sums);
+        list(pkg.bdepends);
+        list(pkg.rdepends);
+        list(pkg.provides);
+        list(pkg.conflicts);
+        list(pkg.features);
+        line(pkg.build_date != 0 ? std::to_string(pkg.build_date) : std::string{});
+        line(pkg.install_date != 0 ? std::to_string(pkg.install_date) : std::string{});
+        line(pkg.install_reason);
+        return record;
+    }
+    // The same checks as check_package() in parse.bash.
+    static bool check_sha256sums(const generic_package& pkg) {
+        if (!pkg.sha256sums.empty() && pkg.sha256sums.size() != pkg.sources.size())
+            return false;
+        return std::all_of(begin(pkg.sha256sums), end(pkg.sha256sums), [](const std::string& sum) {
+            return sum == "SKIP" || sha256::is_valid(sum);
+        });
+    }
+    // Evaluate a package.build with bashconfig::evaluate(), if it only uses the supported subset of bash.
+    static std::optional<std::string> evaluate_native(const std::string& filename) {
+        if (const auto it = config.find("parse.native"); it != config.end() && it->second == "disable")
+            return {};
 
-        if (const int ec = xwait(pid); ec != 0) {
-            printerr(color::ERROR, "{}: Shell terminated with exit code {}.", pkg.name, ec);
+        std::FILE* file = std::fopen(filename.c_str(), "r");
+        if (!file)
             return {};
+
+        try {
+            const auto conf = bashconfig::evaluate(file);
+            std::fclose(file);
+            const auto pkg = config_to_generic(filename, conf);
+            // parse.bash reports invalid checksums.
+            if (!check_sha256sums(pkg))
+                return {};
+            return encode_record(pkg);
+        } catch (const bashconfig::parse_error& e) {
+            std::fclose(file);
+            printerr(color::DEBUG, "{}: {} Falling back to bash.", filename, e.what());
+            return {};
+        }
+    }
+    // Same as start_generic(), but for package.build files.
+    static parse_task start_generic_build(const std::string& filename) {
+        if (auto record = evaluate_native(filename); record.has_value()) {
+            parse_task task;
+            task.filename = filename;
+            task.result = decode_record(filename, record.value());
+            set_provided_by(task.result.value());
+            return task;
+        }
+        return start_generic(filename);
+    }
+    // Same as start_generic_build(), but use $dbdir/repo.idx, if possible.
+    static parse_task start_generic_repo(std::string_view name) {
+        parse_task task;
+        task.filename = fmt::format("{}/{}/package.build", repodir, name);
+        task.name = name;
+        task.stamp = repoindex::make_stamp(name);
+        if (!task.stamp.has_value()) {
+            printerr(color::DEBUG, "Cannot access '{}'.", task.filename);
+            return task;
         }
 
-        struct ::stat st;
-        if (::lstat(filename.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
-            pkg.provided_by = xreadlink(filename);
+        if (const auto cached = repoindex::lookup(name, task.stamp.value()); cached.has_value()) {
+            printerr(color::DEBUG, "Using cached '{}'.", task.filename);
+            task.result = decode_record(task.filename, cached.value());
+        } else if (auto record = evaluate_native(task.filename); record.has_value()) {
+            task.result = decode_record(task.filename, record.value());
+            repoindex::store(name, task.stamp.value(), std::move(record.value()));
+        } else {
+            task.job = parser::start(task.filename);
+            return task;
         }
+        set_provided_by(task.result.value());
+        return task;
+    }
+    static std::optional<generic_package> finish_generic(parse_task& task) {
+        if (task.job.running()) {
+            auto record = parser::finish(task.job);
+            if (!record.has_value())
+                return {};
 
-        return pkg;
+            task.result = decode_record(task.filename, record.value());
+            set_provided_by(task.result.value());
+            if (task.stamp.has_value())
+                repoindex::store(task.name.value(), task.stamp.value(), std::move(record.value()));
+        }
+        return std::move(task.result);
+    }
+    static std::optional<generic_package> parse_generic_info(const std::string& filename) {
+        auto task = start_generic_info(filename);
+        return finish_generic(task);
+    }
+    // Read an installed package from local.db.
+    static std::optional<generic_package> parse_generic_db(std::string_view name) {
+        const auto real_name = localdb::resolve(name);
+        if (!real_name.has_value())
+            return {};
+
+        const auto filename = fmt::format("{}/local.db:{}", dbdir, real_name.value());
+        const auto info = localdb::info(real_name.value()).value();
+        std::FILE* file = ::fmemopen(const_cast<char*>(info.data()), info.size(), "r");
+        if (!file)
+            raise("fmemopen() failed.");
+
+        try {
+            const auto conf = bashconfig::read(file);
+            std::fclose(file);
+
+            auto pkg = config_to_generic(filename, conf);
+            if (real_name.value() != name)
+                pkg.provided_by = real_name.value();
+            return pkg;
+        } catch (const bashconfig::parse_error& e) {
+            std::fclose(file);
+            printerr(color::ERROR, "{}: {}", filename, e.what());
+            return {};
+        }
+    }
+    static std::optional<generic_package> parse_generic_repo(std::string_view name) {
+        auto task = start_generic_repo(name);
+        return finish_generic(task);
     }
     static void generic_to_base(generic_package& generic, package_base& base) {
         base.filename       = std::move(generic.filename);
@@ -213,8 +415,7 @@ namespace minipkg2 {
         base.conflicts      = std::move(generic.conflicts);
         base.provided_by    = std::move(generic.provided_by);
     }
-    std::optional<source_package> source_package::parse_file(const std::string& filename) {
-        auto result = parse_generic(filename);
+    static std::optional<source_package> generic_to_source(std::optional<generic_package>&& result) {
         if (!result.has_value())
             return {};
         auto& generic = result.value();
@@ -222,13 +423,17 @@ namespace minipkg2 {
 
         generic_to_base(generic, pkg);
         pkg.sources         = std::move(generic.sources);
+        pkg.sha256sums      = std::move(generic.sha256sums);
         pkg.bdepends        = std::move(generic.bdepends);
         pkg.features        = std::move(generic.features);
 
         return pkg;
     }
-    std::optional<binary_package_info> binary_package_info::parse_file(const std::string& filename) {
-        auto result = parse_generic(filename);
+    std::optional<source_package> source_package::parse_file(const std::string& filename) {
+        auto task = start_generic_build(filename);
+        return generic_to_source(finish_generic(task));
+    }
+    static std::optional<binary_package_info> generic_to_binary_info(std::optional<generic_package>&& result) {
         if (!result.has_value())
             return {};
 
@@ -240,9 +445,11 @@ namespace minipkg2 {
 
         return pkg;
     }
+    std::optional<binary_package_info> binary_package_info::parse_file(const std::string& filename) {
+        return generic_to_binary_info(parse_generic_info(filename));
+    }
 
-    std::optional<installed_package> installed_package::parse_file(const std::string& filename) {
-        auto result = parse_generic(filename);
+    static std::optional<installed_package> generic_to_installed(std::optional<generic_package>&& result) {
         if (!result.has_value())
             return {};
 
@@ -252,22 +459,67 @@ namespace minipkg2 {
         generic_to_base(generic, pkg);
         pkg.build_date      = generic.build_date;
         pkg.install_date    = generic.install_date;
+        // Packages installed by older versions don't have an install reason.
+        pkg.reason          = generic.install_reason == "dependency" ? install_reason::DEPENDENCY : install_reason::EXPLICIT;
 
         return pkg;
     }
+    std::optional<installed_package> installed_package::parse_file(const std::string& filename) {
+        return generic_to_installed(parse_generic_info(filename));
+    }
     std::optional<source_package> source_package::parse_repo(std::string_view name) {
-        return parse_file(fmt::format("{}/{}/package.build", repodir, name));
+        return generic_to_source(parse_generic_repo(name));
     }
     std::optional<installed_package> installed_package::parse_local(std::string_view name) {
+        if (localdb::enabled())
+            return generic_to_installed(parse_generic_db(name));
         return parse_file(fmt::format("{}/{}/package.info", pkgdir, name));
     }
-    template<class T>
-    static std::set<T> do_parse(const std::string& dirname, std::string_view filename) {
+    // Parse the packages `names` in `dirname`, with up to parser::concurrency() instances of parse.bash running at once.
+    // The results are collected in the order of `names`, so that the output stays deterministic.
+    template<class T, class Start, class Convert>
+    static std::set<T> parse_names(const std::string& dirname, const std::vector<std::string>& names, std::string_view filename,
+                                   const Start& start, const Convert& convert) {
+        const std::size_t max_running = parser::concurrency();
+        std::size_t running = 0;
+        std::deque<parse_task> queue{};
         std::set<T> pkgs{};
+
+        const auto finish_front = [&] {
+            auto& task = queue.front();
+            if (task.job.running())
+                --running;
+
+            auto result = convert(finish_generic(task));
+            if (result.has_value()) {
+                pkgs.insert(std::move(result.value()));
+            } else {
+                printerr(color::WARN, "Failed to parse package '{}'.", task.filename);
+            }
+            queue.pop_front();
+        };
+
+        for (const auto& name : names) {
+            while (running >= max_running)
+                finish_front();
+
+            queue.push_back(start(name, fmt::format("{}/{}/{}", dirname, name, filename)));
+            if (queue.back().job.running())
+                ++running;
+        }
+        while (!queue.empty())
+            finish_front();
+
+        return pkgs;
+    }
+    // Parse all packages in `dirname` (in alphabetical order).
+    template<class T, class Start, class Convert>
+    static std::set<T> do_parse(const std::string& dirname, std::string_view filename, const Start& start, const Convert& convert) {
         ::DIR* dir = ::opendir(dirname.c_str());
         if (!dir)
             raise("Failed to open directory '{}'.", dirname);
 
+        std::vector<std::string> names{};
         struct ::dirent* ent;
         while ((ent = ::readdir(dir)) != nullptr) {
             if (ent->d_name[0] == '.')
@@ -278,157 +530,273 @@ namespace minipkg2 {
             if (::access(path.c_str(), R_OK) != 0)
                 continue;
 
-            auto result = T::parse_file(path);
-            if (result.has_value()) {
-                pkgs.insert(std::move(result.value()));
-            } else {
-                printerr(color::WARN, "Failed to parse package '{}'.", path);
-            }
+            names.emplace_back(ent->d_name);
         }
-        return pkgs;
+        ::closedir(dir);
+        std::sort(begin(names), end(names));
+
+        return parse_names<T>(dirname, names, filename, start, convert);
     }
     std::set<source_package> source_package::parse_repo() {
-        return do_parse<source_package>(repodir, "package.build");
+        std::set<std::string> names{};
+        const auto start = [&names](const std::string& name, const std::string&) {
+            names.insert(name);
+            return start_generic_repo(name);
+        };
+        auto pkgs = do_parse<source_package>(repodir, "package.build", start, generic_to_source);
+        repoindex::retain(names);
+        repoindex::save();
+        return pkgs;
+    }
+    std::set<source_package> source_package::parse_repo(const std::vector<std::string>& names) {
+        const auto start = [](const std::string& name, const std::string&) {
+            return start_generic_repo(name);
+        };
+        auto pkgs = parse_names<source_package>(repodir, names, "package.build", start, generic_to_source);
+        repoindex::save();
+        return pkgs;
+    }
+    bool source_package::verify_native_parser() {
+        ::DIR* dir = ::opendir(repodir.c_str());
+        if (!dir)
+            raise("Failed to open directory '{}'.", repodir);
+
+        std::vector<std::string> names{};
+        struct ::dirent* ent;
+        while ((ent = ::readdir(dir)) != nullptr) {
+            if (ent->d_name[0] != '.')
+                names.emplace_back(ent->d_name);
+        }
+        ::closedir(dir);
+        std::sort(begin(names), end(names));
+
+        std::size_t num_native = 0, num_bash = 0, num_mismatch = 0;
+        for (const auto& name : names) {
+            const auto filename = fmt::format("{}/{}/package.build", repodir, name);
+            if (::access(filename.c_str(), R_OK) != 0)
+                continue;
+
+            const auto native = evaluate_native(filename);
+            if (!native.has_value()) {
+                ++num_bash;
+                continue;
+            }
+            ++num_native;
+
+            auto job = parser::start(filename);
+            const auto record = parser::finish(job);
+            const auto expected = record.has_value() ? encode_record(decode_record(filename, record.value())) : "<error>\n"s;
+            if (native.value() == expected)
+                continue;
+
+            ++num_mismatch;
+            printerr(color::ERROR, "{}: The native parser disagrees with parse.bash:", filename);
+            fmt::print("--- parse.bash\n{}+++ native\n{}", expected, native.value());
+        }
+
+        printerr(color::INFO, "{} packages: {} evaluated natively, {} need bash, {} mismatches.",
+                 num_native + num_bash, num_native, num_bash, num_mismatch);
+        return num_mismatch == 0;
     }
     std::set<installed_package> installed_package::parse_local() {
-        return do_parse<installed_package>(pkgdir, "package.info");
+        if (localdb::enabled()) {
+            std::set<installed_package> pkgs{};
+            for (const auto& name : localdb::packages()) {
+                auto result = generic_to_installed(parse_generic_db(name));
+                if (result.has_value()) {
+                    pkgs.insert(std::move(result.value()));
+                } else {
+                    printerr(color::WARN, "Failed to parse package '{}'.", name);
+                }
+            }
+            return pkgs;
+        }
+
+        const auto start = [](const std::string&, const std::string& path) {
+            return start_generic_info(path);
+        };
+        return do_parse<installed_package>(pkgdir, "package.info", start, generic_to_installed);
+    }
+    std::set<installed_package> installed_package::parse_local(const std::vector<std::string>& names) {
+        if (localdb::enabled()) {
+            std::set<installed_package> pkgs{};
+            for (const auto& name : names) {
+                auto result = generic_to_installed(parse_generic_db(name));
+                if (result.has_value()) {
+                    pkgs.insert(std::move(result.value()));
+                } else {
+                    printerr(color::WARN, "Failed to parse package '{}'.", name);
+                }
+            }
+            return pkgs;
+        }
+
+        const auto start = [](const std::string&, const std::string& path) {
+            return start_generic_info(path);
+        };
+        return parse_names<installed_package>(pkgdir, names, "package.info", start, generic_to_installed);
     }
     std::vector<install_transaction> source_package::resolve_conflicts(const std::vector<source_package>& pkgs, bool strict) {
+        // Selected packages by the names they provide.
+        std::unordered_map<std::string_view, std::vector<std::size_t>> providers{};
+        for (std::size_t i = 0; i < pkgs.size(); ++i) {
+            providers[pkgs[i].name].push_back(i);
+            for (const auto& p : pkgs[i].provides) {
+                auto& list = providers[p];
+                if (list.empty() || list.back() != i)
+                    list.push_back(i);
+            }
+        }
+
+        // Installed packages by the names they conflict with.
         const auto cdb = quickdb::read("conflicts");
-        std::vector<install_transaction> transactions{};
-        bool success = true;
+        std::unordered_map<std::string_view, std::vector<std::string_view>> conflicting{};
+        for (const auto& [name, conflicts] : cdb) {
+            for (const auto& c : conflicts)
+                conflicting[c].push_back(name);
+        }
 
-        for (const auto& pkg : pkgs) {
-            install_transaction trans;
-            trans.pkg = &pkg;
+        // Report all conflicts, before anything is loaded.
+        bool success = true;
+        std::vector<std::set<std::string_view>> removals(pkgs.size());
+        for (std::size_t i = 0; i < pkgs.size(); ++i) {
+            const auto& pkg = pkgs[i];
 
             // 1. Check if it conflicts with a selected package.
-            for (const auto& p2 : pkgs) {
-                if (&pkg == &p2)
-                    continue;
+            std::set<std::size_t> others{};
+            for (const auto& c : pkg.conflicts) {
+                if (const auto it = providers.find(c); it != providers.end()) {
+                    for (const auto j : it->second) {
+                        if (j != i)
+                            others.insert(j);
+                    }
+                }
+            }
+            for (const auto j : others) {
+                printerr(color::ERROR, "Package '{:v}' conflicts with '{:v}'.", pkg, pkgs[j]);
+                success = false;
+            }
 
-                for (const auto& c : pkg.conflicts) {
-                    if (p2.is_provider_of(c)) {
-                        printerr(color::ERROR, "Package '{:v}' conflicts with '{:v}'.", pkg, p2);
+            // 2. Installed packages, that are provided by the selected one, are replaced.
+            const auto replace = [&](std::string_view name) {
+                if (name != pkg.name && cdb.find(std::string{name}) != cdb.end())
+                    removals[i].insert(name);
+            };
+            replace(pkg.name);
+            for (const auto& p : pkg.provides)
+                replace(p);
+
+            // 3. Check if local packages conflict with the selected one.
+            if (const auto it = conflicting.find(pkg.name); it != conflicting.end()) {
+                for (const auto name : it->second) {
+                    if (pkg.is_provider_of(name))
+                        continue;
+                    if (strict) {
+                        printerr(color::ERROR, "Package '{}' conflicts with '{:v}'.", name, pkg);
                         success = false;
-                        break;
+                    } else {
+                        removals[i].insert(name);
                     }
                 }
             }
+        }
 
-            if (!success)
-                return {};
+        if (!success)
+            return {};
 
-            // 2. Check if local packages conflict with the selected one.
-            for (const auto& [name, conflicts] : cdb) {
-                if (pkg.is_provider_of(name)) {
-                    if (name != pkg.name) {
-                        auto result = installed_package::parse_local(name);
-                        assert_result(result, name);
-                        printerr(color::WARN, "Package '{:v}' will be removed because it conflicts with '{:v}'.", result.value(), pkg);
-                        trans.remove.push_back(std::move(result.value()));
-                    }
-                    continue;
-                }
+        // Load all packages that will be removed at once.
+        std::set<std::string_view> names{};
+        for (const auto& r : removals)
+            names.insert(begin(r), end(r));
+        std::unordered_map<std::string, installed_package> loaded{};
+        if (!names.empty()) {
+            for (const auto& p : installed_package::parse_local(std::vector<std::string>(begin(names), end(names))))
+                loaded.emplace(p.name, p);
+        }
 
-                for (const auto& c : conflicts) {
-                    if (c == pkg.name) {
-                        if (pkg.is_provider_of(c) && !strict) {
-                            auto result = installed_package::parse_local(name);
-                            assert_result(result, name);
-                            printerr(color::WARN, "Package '{:v}' will be removed because it conflicts with '{:v}'.", result.value(), pkg);
-                            trans.remove.push_back(std::move(result.value()));
-                        } else {
-                            printerr(color::ERROR, "Package '{}' conflicts with '{:v}'.", name, pkg);
-                            success = false;
-                        }
-                        break;
-                    }
-                }
+        std::vector<install_transaction> transactions{};
+        transactions.reserve(pkgs.size());
+        for (std::size_t i = 0; i < pkgs.size(); ++i) {
+            install_transaction trans;
+            trans.pkg = &pkgs[i];
+            for (const auto name : removals[i]) {
+                const auto it = loaded.find(std::string{name});
+                if (it == loaded.end())
+                    raise("Invalid package: {}", name);
+                printerr(color::WARN, "Package '{:v}' will be removed because it conflicts with '{:v}'.", it->second, pkgs[i]);
+                trans.remove.push_back(it->second);
             }
-
             transactions.push_back(std::move(trans));
         }
-
-        return success ? transactions : std::vector<install_transaction>{};
+        return transactions;
     }
-    bool source_package::download() const {
+    // Sync git sources right away, other sources are added to `transfers`.
+    static bool prepare_sources(const source_package& pkg, std::vector<transfer>& transfers) {
         bool success = true;
-        for (const auto& src : sources) {
-            const auto end = src.rfind('/');
+        for (std::size_t i = 0; i < pkg.sources.size(); ++i) {
+            const auto& src = pkg.sources[i];
+            const auto git_src = git::parse_source(src);
+            const std::string_view url = git_src ? std::string_view{git_src->url} : std::string_view{src};
+            const auto end = url.rfind('/');
             if (end == std::string::npos) {
-                printerr(color::ERROR, "{}: Invalid URL '{}'.", name, src);
+                printerr(color::ERROR, "{}: Invalid URL '{}'.", pkg.name, src);
                 success = false;
                 continue;
             }
 
-            auto dest = fmt::format("{}/{}-{}/src/{}", builddir, name, version, src.substr(end + 1));
+            auto dest = fmt::format("{}/{}-{}/src/{}", builddir, pkg.name, pkg.version, url.substr(end + 1));
+            const auto& sum = i < pkg.sha256sums.size() ? pkg.sha256sums[i] : ""s;
 
-            if (starts_with(src, "git://")) {
+            if (git_src) {
                 // Remove trailing '.git'
                 if (ends_with(dest, ".git"))
                     dest = dest.substr(0, dest.size() - 4);
 
-                success &= git::sync(src, dest);
+                // Every upstream is mirrored once in $cachedir/git, builds get clones that share its objects.
+                success &= git::update_mirror(*git_src) && git::checkout_source(*git_src, dest);
             } else {
-                success &= minipkg2::download(src, dest);
+                transfers.push_back({ src, std::move(dest), sum != "SKIP" ? sum : ""s });
             }
         }
         return success;
     }
+    bool source_package::download() const {
+        std::vector<transfer> transfers{};
+        const bool success = prepare_sources(*this, transfers);
+        return minipkg2::download(transfers) == 0 && success;
+    }
 
 
     // Utility functions.
-    bool source_package::download(const std::vector<source_package>& pkgs) {
+    bool source_package::download(const std::vector<source_package>& pkgs, download_policy policy) {
+        // All files are downloaded at once, a failed one doesn't stop the others.
         bool success = true;
-        for (std::size_t i = 0; i < pkgs.size(); ++i) {
-            const auto& pkg = pkgs[i];
-            printerr(color::LOG, "({}/{}) Downloading {:v}...", i+1, pkgs.size(), pkg);
-
-            success &= pkg.download();
-        }
-        return success;
+        std::vector<transfer> transfers{};
+        for (const auto& pkg : pkgs)
+            success &= prepare_sources(pkg, transfers);
+        return minipkg2::download(transfers, policy) == 0 && success;
     }
-    std::vector<source_package> source_package::resolve(const std::vector<std::string>& args, bool resolve_deps, resolve_skip_policy policy) {
-        std::vector<source_package> pkgs{};
-
-        const auto has = [&pkgs](std::string_view name, bool skip_installed) {
-            return (skip_installed && installed_package::is_installed(name))
-                || contains_if(pkgs, [name](const auto& pkg) {
-                    return pkg.is_provider_of(name);
-                });
-        };
-
-        std::function<void(const std::vector<std::string>&)> do_resolve;
-
-        const auto add = [&](std::string_view name) {
-            auto result = source_package::parse_repo(name);
-            assert_result(result, name);
-            auto& pkg = result.value();
-            if (resolve_deps) {
-                do_resolve(pkg.bdepends);
-                pkgs.push_back(pkg);
-                do_resolve(pkg.rdepends);
-            } else {
-                pkgs.push_back(std::move(pkg));
-            }
-        };
+    std::vector<bool> source_package::download(const std::vector<const source_package*>& pkgs, download_policy policy) {
+        // Like above, but the result is reported for every package.
+        std::vector<bool> results{};
+        std::vector<std::size_t> first(pkgs.size() + 1, 0);
+        std::vector<transfer> transfers{};
+        for (std::size_t k = 0; k < pkgs.size(); ++k) {
+            results.push_back(prepare_sources(*pkgs[k], transfers));
+            first[k + 1] = transfers.size();
+        }
 
-        do_resolve = [&](const std::vector<std::string>& names) {
-            for (const auto& name : names) {
-                if (has(name, policy != resolve_skip_policy::NEVER))
-                    continue;
-                add(name);
+        minipkg2::download(transfers, policy);
+        for (std::size_t k = 0; k < pkgs.size(); ++k) {
+            for (std::size_t t = first[k]; t < first[k + 1]; ++t) {
+                if (!transfers[t].error.empty())
+                    results[k] = false;
             }
-        };
-
-        for (const auto& name : args) {
-            if (has(name, policy == resolve_skip_policy::ALWAYS))
-                continue;
-            add(name);
         }
-
-        return pkgs;
+        return results;
+    }
+    std::vector<source_package> source_package::resolve(const std::vector<std::string>& args, bool resolve_deps, resolve_skip_policy policy) {
+        return depgraph::resolve(args, resolve_deps, policy).packages();
     }
     std::vector<installed_package> installed_package::resolve(const std::vector<std::string>& args) {
         std::vector<installed_package> pkgs{};
@@ -442,6 +810,14 @@ namespace minipkg2 {
         return pkgs;
     }
     std::list<std::string> installed_package::get_files(std::string_view name) {
+        // Lists written by older versions may contain broken paths.
+        if (localdb::enabled()) {
+            std::list<std::string> files{};
+            for (const auto& f : localdb::files(name))
+                files.push_back(fileindex::repair_legacy(f));
+            return files;
+        }
+
         const auto path = fmt::format("{}/{}/files", pkgdir, name);
         std::FILE* file = std::fopen(path.c_str(), "r");
         if (!file)
@@ -454,7 +830,7 @@ namespace minipkg2 {
             if (str.length() >= PATH_MAX) {
                 printerr(color::WARN, "Path '{}' is longer than PATH_MAX.", str);
             }
-            files.push_back(std::move(str.substr(0, str.size()-1)));
+            files.push_back(fileindex::repair_legacy(str.substr(0, str.size()-1)));
         }
 
         std::fclose(file);
@@ -462,7 +838,12 @@ namespace minipkg2 {
     }
 
     // build()
-    std::optional<binary_package> source_package::build(std::string_view path_binpkg, const std::string& filesdir) const {
+    // If `quiet` is set, the output of the build is only written to the log file, even if --verbose is set.
+    // `num_jobs` overrides $JOBS (0: -j or build.jobs).
+    std::optional<binary_package> source_package::build(std::string_view path_binpkg, const std::string& filesdir, bool quiet, std::size_t num_jobs) const {
+        if (num_jobs == 0)
+            num_jobs = jobs;
+
         const auto path_basedir     = fmt::format("{}/{}-{}", builddir, name, version);
         const auto path_srcdir      = path_basedir + "/src";
         const auto path_builddir    = path_basedir + "/build";
@@ -492,21 +873,22 @@ namespace minipkg2 {
         args.push_back(nullptr);
 
         std::vector<char*> env = copy_environ();
-        add_environ(env, "ROOT",        rootdir);
-        add_environ(env, "ENV_FILE",    env_filename);
-        add_environ(env, "MINIPKG2",    self);
+        add_script_environ(env);
         add_environ(env, "HOST",        host);
-        add_environ(env, "JOBS",        fmt::format("{}", jobs));
+        add_environ(env, "JOBS",        fmt::format("{}", num_jobs));
         add_environ(env, "pkgfile",     filename);
         add_environ(env, "srcdir",      path_srcdir);
         add_environ(env, "builddir",    path_builddir);
         add_environ(env, "pkgdir",      path_pkgdir);
         add_environ(env, "filesdir",    filesdir);
+        jobserver::inherit(env, actions);
         env.push_back(nullptr);
 
+        const auto start_time = std::chrono::steady_clock::now();
         ::pid_t pid;
         if (::posix_spawnp(&pid, "bash", &actions, nullptr, args.data(), env.data()) != 0)
             raise("{}: build(): Failed to posix_spawn() the shell.", name);
+        ++spawn_count;
 
         // Cleanup.
         xclose(pipefd[1]);
@@ -524,7 +906,7 @@ namespace minipkg2 {
 
         char buffer[100];
         while (std::fgets(buffer, sizeof buffer, log) != nullptr) {
-            if (verbosity >= verbosity_level::VERBOSE)
+            if (!quiet && verbosity >= verbosity_level::VERBOSE)
                 std::fputs(buffer, stderr);
             std::fputs(buffer, logfile);
         }
@@ -532,13 +914,18 @@ namespace minipkg2 {
         std::fclose(logfile);
         std::fclose(log);
 
-        if (const int ec = xwait(pid); ec != 0) {
-            if (verbosity < verbosity_level::VERBOSE)
+        struct ::rusage usage;
+        if (const int ec = xwait(pid, usage); ec != 0) {
+            if (quiet || verbosity < verbosity_level::VERBOSE)
                 cat(stderr, path_logfile);
             printerr(color::ERROR, "Failed to build package '{:v}'. Log file: '{}'.", *this, path_logfile);
             return {};
         }
 
+        const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start_time;
+        const auto seconds = [](const struct ::timeval& tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+        buildstats::record(name, version, { wall.count(), seconds(usage.ru_utime) + seconds(usage.ru_stime), num_jobs });
+
         binary_package_info info(*this, std::time(nullptr));
 
         mkdir_p(path_metadir);
@@ -559,7 +946,7 @@ namespace minipkg2 {
         ::closedir(dir);
 
         const auto cmd = fmt::format("{} tar -C '{}' -caf '{}' {}", FAKEROOT, path_pkgdir, path_binpkg, files_list);
-        if (std::system(cmd.c_str()) != 0) {
+        if (xsystem(cmd) != 0) {
             printerr(color::ERROR, "Can't create binary package.");
             return {};
         }
@@ -567,14 +954,16 @@ namespace minipkg2 {
     }
 
     // install()
-    bool binary_package::install() const {
+    bool binary_package::install(bool force, bool is_explicit) const {
         const auto pkg_pkgdir       = fmt::format("{}/{}", pkgdir, pkg.name);
         const auto pkg_filesfile    = pkg_pkgdir + "/files";
+        const bool use_localdb      = localdb::enabled();
         std::string cmd;
 
         // TODO: Check for superuser priviliges.
 
-        mkdir_p(pkg_pkgdir);
+        if (!use_localdb)
+            mkdir_p(pkg_pkgdir);
 
         std::list<std::string> old_files;
         auto old_pkg = installed_package::parse_local(pkg.name);
@@ -587,11 +976,12 @@ namespace minipkg2 {
             std::FILE* file = ::popen(cmd.c_str(), "r");
             if (!file)
                 raise("Can't get list of files of '{}'.", path);
+            ++spawn_count;
 
             std::vector<std::string> files{};
             std::string line;
             while (freadline(file, line)) {
-                files.push_back(line.substr(1));
+                files.push_back(fileindex::normalize(line));
             }
             ::pclose(file);
             return files;
@@ -599,27 +989,41 @@ namespace minipkg2 {
 
         const auto new_files = get_new_files();
 
+        // Check if any of the files belongs to another package.
+        if (!force) {
+            const auto collisions = fileindex::collisions(pkg.name, new_files);
+            for (const auto& [file, owner] : collisions) {
+                printerr(color::ERROR, "{}: '{}' is already owned by '{}'.", pkg.name, file, owner);
+            }
+            if (!collisions.empty())
+                return false;
+        }
+
         // Extract the package.
         const auto opts = verbosity >= verbosity_level::VERBOSE ? "-xhpvf" : "-xhpf";
         cmd = fmt::format("tar -C '{}' {} '{}' --exclude='.meta'", rootdir, opts, path);
-        if (std::system(cmd.c_str()) != 0) {
+        if (xsystem(cmd) != 0) {
             printerr(color::ERROR, "{}: Failed to extract package.", pkg.name);
             return false;
         }
 
         // Write new_files into files file.
-        std::FILE* files_file = std::fopen(pkg_filesfile.c_str(), "w");
-        if (!files_file) {
-            printerr(color::ERROR, "Failed to open '{}'.", pkg_filesfile);
-            return false;
-        }
+        if (!use_localdb) {
+            std::FILE* files_file = std::fopen(pkg_filesfile.c_str(), "w");
+            if (!files_file) {
+                printerr(color::ERROR, "Failed to open '{}'.", pkg_filesfile);
+                return false;
+            }
 
-        for (const auto& f : new_files) {
-            std::fprintf(files_file, "%s\n", f.c_str());
+            for (const auto& f : new_files) {
+                std::fprintf(files_file, "%s\n", f.c_str());
+            }
+
+            std::fclose(files_file);
         }
 
-        std::fclose(files_file);
 
+        fileindex::update(pkg.name, new_files);
 
         // Find and delete files that are part of the old package
         // but not in the new package...
@@ -630,27 +1034,35 @@ namespace minipkg2 {
             rm(rootdir, old_files);
         }
 
-        // Remove old symlinks, if any.
-        if (old_pkg.has_value()) {
-            for (const auto& name : old_pkg.value().provides) {
-                rm(fmt::format("{}/{}", pkgdir, name));
+        auto reason = install_reason::EXPLICIT;
+        if (!is_explicit)
+            reason = old_pkg.has_value() ? old_pkg.value().reason : install_reason::DEPENDENCY;
+        installed_package ipkg(pkg, std::time(nullptr), reason);
+        if (use_localdb) {
+            // local.db keeps track of provided packages by itself.
+            localdb::put(pkg.name, ipkg.to_config(), new_files);
+        } else {
+            // Remove old symlinks, if any.
+            if (old_pkg.has_value()) {
+                for (const auto& name : old_pkg.value().provides) {
+                    rm(fmt::format("{}/{}", pkgdir, name));
+                }
             }
-        }
 
-        // Create symlinks to provided packages.
-        for (const auto& name : pkg.provides) {
-            symlink_v(pkg.name, fmt::format("{}/{}", pkgdir, name));
-        }
+            // Create symlinks to provided packages.
+            for (const auto& name : pkg.provides) {
+                symlink_v(pkg.name, fmt::format("{}/{}", pkgdir, name));
+            }
 
-        // Create the package.info file.
-        installed_package ipkg(pkg, std::time(nullptr));
-        bashconfig::write_file(pkg_pkgdir + "/package.info", ipkg.to_config());
+            // Create the package.info file.
+            bashconfig::write_file(pkg_pkgdir + "/package.info", ipkg.to_config());
+        }
 
         // Run the post-install script, if available.
         cmd = fmt::format("tar -tf '{}' .meta/post-install.sh >/dev/null 2>/dev/null", path);
-        if (std::system(cmd.c_str()) == 0) {
+        if (xsystem(cmd) == 0) {
             cmd = fmt::format("tar -xf '{}' .meta/post-install.sh -O | bash", path);
-            if (std::system(cmd.c_str()) != 0) {
+            if (xsystem(cmd) != 0) {
                 printerr(color::WARN, "{}: Post-install script failed.", pkg.name);
                 return false;
             }
@@ -659,12 +1071,16 @@ namespace minipkg2 {
         quickdb::set("conflicts", pkg.name, pkg.conflicts);
 
         // Configure the reverse-dependencies.
-        auto db = quickdb::read("rdeps");
-        db[pkg.name] = {};
+        if (!quickdb::contains("rdeps", pkg.name))
+            quickdb::set("rdeps", pkg.name, std::set<std::string>{});
         for (const auto& dep : pkg.rdepends) {
-            db[dep].insert(pkg.name);
+            const auto rdeps = quickdb::lookup("rdeps", dep);
+            if (contains(rdeps, pkg.name))
+                continue;
+            std::set<std::string> value{begin(rdeps), end(rdeps)};
+            value.insert(pkg.name);
+            quickdb::set("rdeps", dep, std::move(value));
         }
-        quickdb::write("rdeps", db);
 
         // TODO: Copy the binpkg to /var/cache/minipkg2/binpkgs
         const auto binpkgsdir = cachedir + "/binpkgs";
@@ -680,25 +1096,31 @@ namespace minipkg2 {
         success &= rm(rootdir, files);
 
         // Remove the package and it's provided symlinks.
-        for (const auto& p : provides) {
-            success &= rm(fmt::format("{}/{}", pkgdir, p));
+        if (localdb::enabled()) {
+            localdb::erase(name);
+        } else {
+            for (const auto& p : provides) {
+                success &= rm(fmt::format("{}/{}", pkgdir, p));
+            }
+            success &= rm_rf(fmt::format("{}/{}", pkgdir, name));
         }
-        success &= rm_rf(fmt::format("{}/{}", pkgdir, name));
 
         if (!success)
             return false;
 
+        fileindex::update(name, {});
+
         // Remove package from conflicts.db
         quickdb::remove("conflicts", name);
 
         // Remove package and references to it from rdeps.db
-        auto db = quickdb::read("rdeps");
-        db.erase(name);
-        for (auto& [_, rdeps] : db) {
-            rdeps.erase(name);
-        }
-        quickdb::write("rdeps", db);
         quickdb::remove("rdeps", name);
+        for (const auto& key : quickdb::keys_containing("rdeps", name)) {
+            const auto rdeps = quickdb::lookup("rdeps", key);
+            std::set<std::string> value{begin(rdeps), end(rdeps)};
+            value.erase(name);
+            quickdb::set("rdeps", key, std::move(value));
+        }
 
         return true;
     }
@@ -721,6 +1143,8 @@ namespace minipkg2 {
         return result.has_value() ? binary_package{ std::move(path), std::move(result.value()) } : std::optional<binary_package>{};
     }
     bool installed_package::is_installed(std::string_view name) {
+         if (localdb::enabled())
+             return localdb::resolve(name).has_value();
          const auto path = fmt::format("{}/{}/package.info", pkgdir, name);
          return ::access(path.c_str(), F_OK) == 0;
     }
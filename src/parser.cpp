@@ -0,0 +1,280 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <vector>
+#include "minipkg2.hpp"
+#include "parser.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::parser {
+    // A `parse.bash --server` process.
+    struct server {
+        ::pid_t pid;
+        int in;                 // Requests (filenames).
+        std::FILE* out;         // Replies (records).
+        std::size_t pending;    // Number of unanswered requests.
+    };
+
+    static std::vector<std::unique_ptr<server>> servers{};
+
+    // Spawn parse.bash with the environment it expects.
+    static ::pid_t spawn(const char* arg, int fd_in, int fd_out, int fd_close, int fd_err = -1) {
+        // Construct the file descriptor description.
+        ::posix_spawn_file_actions_t actions;
+        ::posix_spawn_file_actions_init(&actions);
+        if (fd_in < 0) {
+            ::posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        } else {
+            ::posix_spawn_file_actions_adddup2(&actions, fd_in, STDIN_FILENO);
+        }
+        ::posix_spawn_file_actions_addclose(&actions, fd_close);
+        ::posix_spawn_file_actions_adddup2(&actions, fd_out, STDOUT_FILENO);
+        if (fd_err >= 0)
+            ::posix_spawn_file_actions_adddup2(&actions, fd_err, STDERR_FILENO);
+
+        // Construct argv.
+        std::vector<char*> args{};
+        args.push_back(xstrdup("bash"));
+        args.push_back(xstrdup(parse_filename));
+        args.push_back(xstrdup(arg));
+        args.push_back(nullptr);
+
+        // Construct envp.
+        std::vector<char*> env = copy_environ();
+        add_script_environ(env);
+        env.push_back(nullptr);
+
+        ::pid_t pid;
+        if (::posix_spawnp(&pid, "bash", &actions, nullptr, args.data(), env.data()) != 0)
+            raise("{}: parse(): Failed to posix_spawn() the shell.", arg);
+        ++spawn_count;
+
+        // Cleanup.
+        free_environ(args);
+        free_environ(env);
+        ::posix_spawn_file_actions_destroy(&actions);
+        return pid;
+    }
+
+    static bool use_servers() {
+        const auto it = config.find("parse.server");
+        return it == config.end() || it->second != "disable";
+    }
+    static void close_server(server& srv) {
+        ::close(srv.in);
+        std::fclose(srv.out);
+        // A server that is gone may have been killed by a signal.
+        int wstatus;
+        const bool waited = ::waitpid(srv.pid, &wstatus, 0) == srv.pid;
+        srv.pid = -1;
+        if (waited && WIFSIGNALED(wstatus)) {
+            printerr(color::WARN, "Parse server was killed by signal {}.", WTERMSIG(wstatus));
+        } else if (waited && WEXITSTATUS(wstatus) != 0) {
+            printerr(color::WARN, "Parse server terminated with exit code {}.", WEXITSTATUS(wstatus));
+        }
+    }
+    static void stop_servers() {
+        for (auto& srv : servers) {
+            if (srv->pid != -1)
+                close_server(*srv);
+        }
+        servers.clear();
+    }
+    static server* start_server() {
+        int request[2], reply[2];
+        xpipe(request);
+        xpipe(reply);
+
+        const ::pid_t pid = spawn("--server", request[0], reply[1], reply[0]);
+        xclose(request[0]);
+        xclose(reply[1]);
+
+        std::FILE* out = ::fdopen(reply[0], "r");
+        if (!out)
+            raise("Failed to smoke on pipe.");
+
+        if (servers.empty())
+            std::atexit(stop_servers);
+
+        printerr(color::DEBUG, "Started parse server {}.", pid);
+        servers.push_back(std::make_unique<server>(server{pid, request[1], out, 0}));
+        return servers.back().get();
+    }
+    // Pick the least busy server, start a new one if all are busy.
+    static server* get_server() {
+        server* best = nullptr;
+        std::size_t alive = 0;
+        for (auto& srv : servers) {
+            if (srv->pid == -1)
+                continue;
+            ++alive;
+            if (!best || srv->pending < best->pending)
+                best = srv.get();
+        }
+        if (!best || (best->pending != 0 && alive < concurrency()))
+            best = start_server();
+        return best;
+    }
+
+    // Send a request, a server that is gone must not kill us with SIGPIPE.
+    static bool send_request(server& srv, const std::string& filename) {
+        ::sigset_t sigpipe, old, pending;
+        ::sigemptyset(&sigpipe);
+        ::sigaddset(&sigpipe, SIGPIPE);
+        ::pthread_sigmask(SIG_BLOCK, &sigpipe, &old);
+        ::sigpending(&pending);
+        const bool was_pending = ::sigismember(&pending, SIGPIPE);
+
+        const std::string request = filename + '\n';
+        std::size_t done = 0;
+        while (done < request.size()) {
+            const ::ssize_t n = ::write(srv.in, request.data() + done, request.size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                break;
+            done += static_cast<std::size_t>(n);
+        }
+
+        // Discard the SIGPIPE of a failed write before unblocking it.
+        const int error = errno;
+        if (done < request.size() && error == EPIPE && !was_pending) {
+            const ::timespec zero{0, 0};
+            ::sigtimedwait(&sigpipe, nullptr, &zero);
+        }
+        ::pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+        if (done < request.size()) {
+            printerr(color::WARN, "Parse server {} is gone: {}.", srv.pid, std::strerror(error));
+            close_server(srv);
+            return false;
+        }
+        return true;
+    }
+
+    job start(const std::string& filename) {
+        printerr(color::DEBUG, "Parsing '{}'...", filename);
+        if (::access(filename.c_str(), R_OK) != 0) {
+            printerr(color::DEBUG, "Cannot access '{}'.", filename);
+            return job{filename};
+        }
+
+        if (use_servers() && !contains(filename, '\n')) {
+            server* srv = get_server();
+            if (send_request(*srv, filename)) {
+                ++srv->pending;
+                return job{filename, -1, nullptr, srv};
+            }
+            // Parse this file with a shell of its own.
+        }
+
+        // Keep stderr until the job is finished, so that the output of parallel jobs doesn't interleave.
+        const int err = ::memfd_create("parse.bash", MFD_CLOEXEC);
+        if (err < 0)
+            raise("{}: memfd_create() failed.", filename);
+
+        int pipefd[2];
+        xpipe(pipefd);
+        const ::pid_t pid = spawn(filename.c_str(), -1, pipefd[1], pipefd[0], err);
+        xclose(pipefd[1]);
+
+        std::FILE* file = ::fdopen(pipefd[0], "r");
+        if (!file)
+            raise("Failed to smoke on pipe.");
+
+        return job{filename, pid, file, nullptr, err};
+    }
+    // Read the reply to the oldest request of a server.
+    static std::optional<std::string> finish_server(job& j) {
+        server* srv = j.srv;
+        j.srv = nullptr;
+        --srv->pending;
+
+        if (srv->pid == -1) {
+            printerr(color::ERROR, "{}: Parse server is gone.", j.filename);
+            return {};
+        }
+
+        std::string record{};
+        std::string line;
+        while (freadline(srv->out, line)) {
+            // The status may follow output that doesn't end with a newline.
+            if (const auto pos = line.find('\x1e'); pos != std::string::npos) {
+                record.append(line, 0, pos);
+
+                // The status is followed by the lines the package printed to stderr.
+                int ec = 0;
+                std::size_t num_lines = 0;
+                std::sscanf(line.c_str() + pos + 1, "%d %zu", &ec, &num_lines);
+                for (std::string err; num_lines != 0 && freadline(srv->out, err); --num_lines)
+                    fmt::print(stderr, "{}\n", err);
+
+                if (ec != 0) {
+                    printerr(color::ERROR, "{}: Shell terminated with exit code {}.", j.filename, ec);
+                    return {};
+                }
+                return record;
+            }
+            record += line;
+            record += '\n';
+        }
+
+        printerr(color::ERROR, "{}: Unexpected end of reply from the parse server.", j.filename);
+        close_server(*srv);
+        return {};
+    }
+    // Print what a shell of its own wrote to stderr.
+    static void print_stderr(job& j) {
+        char buffer[4096];
+        ::off_t offset = 0;
+        ::ssize_t n;
+        while ((n = ::pread(j.err, buffer, sizeof buffer, offset)) > 0) {
+            std::fwrite(buffer, 1, static_cast<std::size_t>(n), stderr);
+            offset += n;
+        }
+        xclose(j.err);
+        j.err = -1;
+    }
+    std::optional<std::string> finish(job& j) {
+        if (j.srv)
+            return finish_server(j);
+
+        if (!j.running())
+            return {};
+
+        // Read the package information.
+        std::string record{};
+        char buffer[512];
+        std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof buffer, j.file)) != 0)
+            record.append(buffer, n);
+
+        std::fclose(j.file);
+        j.file = nullptr;
+
+        const int ec = xwait(j.pid);
+        j.pid = -1;
+        print_stderr(j);
+        if (ec != 0) {
+            printerr(color::ERROR, "{}: Shell terminated with exit code {}.", j.filename, ec);
+            return {};
+        }
+
+        return record;
+    }
+    std::size_t concurrency() {
+        if (jobs != 0)
+            return jobs;
+        const long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? static_cast<std::size_t>(n) : 1;
+    }
+}
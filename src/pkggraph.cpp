@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <memory>
+#include "pkggraph.hpp"
+#include "package.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::pkggraph {
+    static std::unique_ptr<graph> loaded{};
+
+    std::optional<node> graph::find(std::string_view name) const {
+        const auto it = providers.find(std::string{name});
+        if (it == providers.end())
+            return {};
+        return it->second;
+    }
+
+    // Convert per-node edge lists into offsets and one flat array.
+    static void flatten(const std::vector<std::vector<node>>& lists, std::vector<node>& offsets, std::vector<node>& edges) {
+        offsets.reserve(lists.size() + 1);
+        offsets.push_back(0);
+        for (const auto& list : lists) {
+            edges.insert(end(edges), begin(list), end(list));
+            offsets.push_back(static_cast<node>(edges.size()));
+        }
+    }
+
+    const graph& load() {
+        if (loaded)
+            return *loaded;
+
+        auto g = std::make_unique<graph>();
+        const auto installed = installed_package::parse_local();
+        for (const auto& pkg : installed) {
+            g->names.push_back(pkg.name);
+            g->is_explicit.push_back(pkg.reason == install_reason::EXPLICIT);
+        }
+
+        // A package's own name takes precedence over names provided by other packages.
+        for (node n = 0; n < g->size(); ++n)
+            g->providers.emplace(g->names[n], n);
+        node n = 0;
+        for (const auto& pkg : installed) {
+            for (const auto& p : pkg.provides)
+                g->providers.emplace(p, n);
+            ++n;
+        }
+
+        std::vector<std::vector<node>> deps(g->size()), rdeps(g->size());
+        n = 0;
+        for (const auto& pkg : installed) {
+            for (const auto& dep : pkg.rdepends) {
+                const auto d = g->find(dep);
+                if (!d.has_value() || d.value() == n || contains(deps[n], d.value()))
+                    continue;
+                deps[n].push_back(d.value());
+                rdeps[d.value()].push_back(n);
+            }
+            ++n;
+        }
+        flatten(deps, g->dep_offsets, g->deps);
+        flatten(rdeps, g->rdep_offsets, g->rdeps);
+
+        loaded = std::move(g);
+        return *loaded;
+    }
+
+    std::vector<node> why(const graph& g, node target) {
+        // Breadth-first search from `target` towards its dependents.
+        constexpr auto none = static_cast<node>(-1);
+        std::vector<node> next(g.size(), none);
+        std::vector<bool> seen(g.size(), false);
+        std::vector<node> queue{target};
+        seen[target] = true;
+
+        for (std::size_t k = 0; k < queue.size(); ++k) {
+            const auto i = queue[k];
+            if (g.is_explicit[i]) {
+                std::vector<node> chain{};
+                for (auto j = i; j != none; j = next[j])
+                    chain.push_back(j);
+                return chain;
+            }
+
+            const auto [begin, end] = g.dependents(i);
+            for (auto it = begin; it != end; ++it) {
+                if (!seen[*it]) {
+                    seen[*it] = true;
+                    next[*it] = i;
+                    queue.push_back(*it);
+                }
+            }
+        }
+        return {};
+    }
+
+    std::vector<std::pair<node, node>> reverse_dependencies(const graph& g, const std::vector<node>& targets, bool transitive) {
+        std::vector<bool> seen(g.size(), false);
+        for (const auto t : targets)
+            seen[t] = true;
+
+        std::vector<std::pair<node, node>> result{};
+        std::vector<node> queue(begin(targets), end(targets));
+        for (std::size_t k = 0; k < queue.size(); ++k) {
+            const auto i = queue[k];
+            const auto [begin, end] = g.dependents(i);
+            for (auto it = begin; it != end; ++it) {
+                if (seen[*it])
+                    continue;
+                seen[*it] = true;
+                result.emplace_back(*it, i);
+                if (transitive)
+                    queue.push_back(*it);
+            }
+        }
+        return result;
+    }
+
+    void write_dot(std::FILE* file, const graph& g, const std::vector<std::pair<node, node>>& edges) {
+        std::vector<node> nodes{};
+        for (const auto& [a, b] : edges) {
+            nodes.push_back(a);
+            nodes.push_back(b);
+        }
+        std::sort(begin(nodes), end(nodes));
+        nodes.erase(std::unique(begin(nodes), end(nodes)), end(nodes));
+
+        fmt::print(file, "digraph minipkg2 {{\n");
+        for (const auto n : nodes)
+            fmt::print(file, "    \"{}\"{};\n", g.names[n], g.is_explicit[n] ? " [style=bold]" : "");
+        for (const auto& [a, b] : edges)
+            fmt::print(file, "    \"{}\" -> \"{}\";\n", g.names[a], g.names[b]);
+        fmt::print(file, "}}\n");
+    }
+}
@@ -1,76 +1,488 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <fmt/format.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <optional>
+#include <cstring>
 #include <cstdio>
+#include <vector>
 #include "minipkg2.hpp"
+#include "fileindex.hpp"
+#include "localdb.hpp"
 #include "quickdb.hpp"
 #include "utils.hpp"
 #include "print.hpp"
 
+// Every database consists of a snapshot ($dbdir/NAME.db) and a journal ($dbdir/NAME.db.log).
+//
+// The snapshot is memory-mapped and used without parsing it. All strings are interned
+// into a sorted table of names, the values of the keys are stored as adjacency arrays (CSR):
+//   header, names[], keys[], offsets[num_keys + 1], edges[], string data
+// The values of keys[i] are edges[offsets[i]] to edges[offsets[i + 1] - 1].
+// keys[] and the edges of every key are sorted, because ids are ordered like the names.
+//
+// The journal contains one line per modification:
+//   +key:value1,value2    (set)
+//   -key                  (erase)
+// Journal records are absolute, so replaying them more than once is harmless.
 namespace minipkg2::quickdb {
-    quickdb read(std::string_view name) {
-        const auto filename = fmt::format("{}/{}.db", dbdir, name);
-        std::FILE* file = std::fopen(filename.c_str(), "r");
-        if (!file)
-            return {};
-        quickdb db{};
+    static constexpr char magic[8] = "MPKGQDB";
+    static constexpr std::uint32_t format_version = 1;
+
+    // Compact the journal, once it is bigger than this or bigger than the snapshot.
+    static constexpr off_t min_compact_size = 64 * 1024;
+
+    struct header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t num_names;
+        std::uint32_t num_keys;
+        std::uint32_t num_edges;
+    };
+    struct str {
+        std::uint32_t off;
+        std::uint32_t len;
+    };
+
+    struct snapshot {
+        void* map = nullptr;
+        std::size_t mapsize = 0;
+        const str* names = nullptr;
+        const std::uint32_t* keys = nullptr;
+        const std::uint32_t* offsets = nullptr;
+        const std::uint32_t* edges = nullptr;
+        std::uint32_t num_names = 0;
+        std::uint32_t num_keys = 0;
+
+        std::string_view name(std::uint32_t id) const {
+            return { static_cast<const char*>(map) + names[id].off, names[id].len };
+        }
+        std::optional<std::uint32_t> find_name(std::string_view n) const {
+            const auto* end = names + num_names;
+            const auto* it = std::lower_bound(names, end, n, [this](const str& s, std::string_view n) {
+                return name(static_cast<std::uint32_t>(&s - names)) < n;
+            });
+            if (it == end || name(static_cast<std::uint32_t>(it - names)) != n)
+                return {};
+            return static_cast<std::uint32_t>(it - names);
+        }
+        // Get the index of a key in keys[].
+        std::optional<std::uint32_t> find_key(std::string_view key) const {
+            const auto id = find_name(key);
+            if (!id.has_value())
+                return {};
+            const auto* end = keys + num_keys;
+            const auto* it = std::lower_bound(keys, end, id.value());
+            if (it == end || *it != id.value())
+                return {};
+            return static_cast<std::uint32_t>(it - keys);
+        }
+        bool has_edge(std::uint32_t idx, std::uint32_t id) const {
+            return std::binary_search(edges + offsets[idx], edges + offsets[idx + 1], id);
+        }
+        void unmap() {
+            if (map)
+                ::munmap(map, mapsize);
+            *this = snapshot{};
+        }
+    };
+
+    using overlay_map = std::map<std::string, std::optional<std::set<std::string>>, std::less<>>;
+    struct database {
+        snapshot snap;
+        overlay_map overlay;    // Modifications on top of the snapshot, std::nullopt marks an erased key.
+        std::string pending;    // Journal records that were not committed yet.
+        bool loaded = false;
+        bool legacy = false;    // The snapshot is in the old text format and must be converted.
+    };
+    static std::map<std::string, database, std::less<>> databases{};
+    static std::size_t open_transactions = 0;
+
+    static std::string db_filename(std::string_view name) {
+        return fmt::format("{}/{}.db", dbdir, name);
+    }
+    static std::string log_filename(std::string_view name) {
+        return fmt::format("{}/{}.db.log", dbdir, name);
+    }
+    static off_t file_size(const std::string& filename) {
+        struct ::stat st;
+        return ::stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+    }
+
+    // Parse "key:value1,value2".
+    static bool parse_record(std::string_view line, std::string& key, std::set<std::string>& values) {
+        const auto end_name = line.find(':');
+        if (end_name == std::string_view::npos)
+            return false;
+        key = line.substr(0, end_name);
+        values.clear();
+
+        line.remove_prefix(end_name + 1);
+        while (!line.empty()) {
+            const auto end = line.find(',');
+            values.emplace(line.substr(0, end));
+            if (end == std::string_view::npos)
+                break;
+            line.remove_prefix(end + 1);
+        }
+        return true;
+    }
+    static void format_record(std::string& out, const std::string& key, const std::set<std::string>& values) {
+        out += key;
+        out += ':';
+        for (auto it = values.begin(); it != values.end(); ++it) {
+            if (it != values.begin())
+                out += ',';
+            out += *it;
+        }
+        out += '\n';
+    }
+
+    // Map the snapshot, returns false if the file is not in the snapshot format.
+    static bool map_snapshot(std::string_view name, database& db) {
+        const auto filename = db_filename(name);
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return true;
 
+        struct ::stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            xclose(fd);
+            return true;
+        }
+
+        auto& snap = db.snap;
+        snap.mapsize = static_cast<std::size_t>(st.st_size);
+        snap.map = ::mmap(nullptr, snap.mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+        xclose(fd);
+        if (snap.map == MAP_FAILED) {
+            snap = snapshot{};
+            raise("Failed to mmap() '{}'.", filename);
+        }
+
+        const auto* hdr = static_cast<const header*>(snap.map);
+        if (snap.mapsize < sizeof(header) || std::memcmp(hdr->magic, magic, sizeof magic) != 0) {
+            snap.unmap();
+            return false;
+        }
+
+        const std::size_t size = sizeof(header)
+                               + hdr->num_names * sizeof(str)
+                               + (hdr->num_keys * std::size_t{2} + 1 + hdr->num_edges) * sizeof(std::uint32_t);
+        if (hdr->version != format_version || size > snap.mapsize)
+            raise("{}: Invalid or unsupported database.", filename);
+
+        snap.names     = reinterpret_cast<const str*>(hdr + 1);
+        snap.keys      = reinterpret_cast<const std::uint32_t*>(snap.names + hdr->num_names);
+        snap.offsets   = snap.keys + hdr->num_keys;
+        snap.edges     = snap.offsets + hdr->num_keys + 1;
+        snap.num_names = hdr->num_names;
+        snap.num_keys  = hdr->num_keys;
+        return true;
+    }
+    static void load(std::string_view name, database& db) {
+        db.loaded = true;
+
+        std::string key;
+        std::set<std::string> values;
         std::string line;
-        while (freadline(file, line)) {
-            const auto end_name = line.find(':');
-            if (end_name == std::string::npos) {
-                printerr(color::WARN, "Invalid conflicts.db file.");
-                continue;
+
+        if (!map_snapshot(name, db)) {
+            // Import the old text format ("key:value1,value2").
+            if (std::FILE* file = std::fopen(db_filename(name).c_str(), "r")) {
+                while (freadline(file, line)) {
+                    if (!parse_record(line, key, values)) {
+                        printerr(color::WARN, "Invalid {}.db file.", name);
+                        continue;
+                    }
+                    db.overlay[key] = std::move(values);
+                }
+                std::fclose(file);
             }
-            const auto name = line.substr(0, end_name);
-            std::set<std::string> conflicts{};
-
-            auto it = line.begin() + end_name + 1;
-            if (it != line.end()) {
-                while (true) {
-                    const auto start = it;
-                    while (it != line.end() && *it != ',')
-                        ++it;
-                    conflicts.emplace(start, it);
-                    if (it == line.end() || *it != ',')
-                        break;
-                    ++it;
+            db.legacy = true;
+        }
+
+        const auto logname = log_filename(name);
+        if (std::FILE* file = std::fopen(logname.c_str(), "r")) {
+            // A record is only complete, if it ends with a newline.
+            off_t valid_size = 0;
+            int ch;
+            line.clear();
+            while ((ch = std::fgetc(file)) != EOF) {
+                if (ch != '\n') {
+                    line += static_cast<char>(ch);
+                    continue;
+                }
+                valid_size += static_cast<off_t>(line.size() + 1);
+                if (!line.empty() && line[0] == '-') {
+                    db.overlay[line.substr(1)] = std::nullopt;
+                } else if (!line.empty() && line[0] == '+' && parse_record(std::string_view{line}.substr(1), key, values)) {
+                    db.overlay[key] = std::move(values);
+                } else {
+                    printerr(color::WARN, "Invalid record in {}.db.log.", name);
                 }
+                line.clear();
+            }
+            std::fclose(file);
+
+            // Cut off the remains of an interrupted commit, so that new records can be appended.
+            if (!line.empty()) {
+                printerr(color::WARN, "Discarding incomplete record in {}.db.log.", name);
+                if (::truncate(logname.c_str(), valid_size) != 0)
+                    printerr(color::WARN, "Failed to truncate '{}': {}.", logname, std::strerror(errno));
+            }
+        }
+    }
+    static database& get_db(std::string_view name) {
+        auto it = databases.find(name);
+        if (it == databases.end())
+            it = databases.emplace(std::string{name}, database{}).first;
+        if (!it->second.loaded)
+            load(name, it->second);
+        return it->second;
+    }
+
+    // Write the snapshot from the current contents and remove the journal.
+    static bool compact_db(std::string_view name, database& db) {
+        const auto data = read(name);
+
+        // Intern all strings.
+        std::vector<std::string_view> names{};
+        for (const auto& [key, values] : data) {
+            names.push_back(key);
+            names.insert(end(names), begin(values), end(values));
+        }
+        std::sort(begin(names), end(names));
+        names.erase(std::unique(begin(names), end(names)), end(names));
+        const auto id_of = [&names](std::string_view n) {
+            return static_cast<std::uint32_t>(std::lower_bound(begin(names), end(names), n) - begin(names));
+        };
+
+        header hdr{};
+        std::memcpy(hdr.magic, magic, sizeof magic);
+        hdr.version = format_version;
+        hdr.num_names = static_cast<std::uint32_t>(names.size());
+        hdr.num_keys = static_cast<std::uint32_t>(data.size());
+
+        std::vector<std::uint32_t> keys{}, offsets{}, edges{};
+        for (const auto& [key, values] : data) {
+            keys.push_back(id_of(key));
+            offsets.push_back(static_cast<std::uint32_t>(edges.size()));
+            for (const auto& v : values)
+                edges.push_back(id_of(v));
+        }
+        offsets.push_back(static_cast<std::uint32_t>(edges.size()));
+        hdr.num_edges = static_cast<std::uint32_t>(edges.size());
+
+        const std::size_t strings_off = sizeof(header)
+                                      + names.size() * sizeof(str)
+                                      + (keys.size() + offsets.size() + edges.size()) * sizeof(std::uint32_t);
+        std::vector<str> name_table{};
+        std::string strings{};
+        for (const auto& n : names) {
+            name_table.push_back(str{static_cast<std::uint32_t>(strings_off + strings.size()), static_cast<std::uint32_t>(n.size())});
+            strings += n;
+        }
+
+        const auto filename = db_filename(name);
+        const auto tmpname = filename + ".tmp";
+        std::FILE* file = std::fopen(tmpname.c_str(), "wb");
+        if (!file) {
+            printerr(color::ERROR, "Failed to open '{}'.", tmpname);
+            return false;
+        }
+        bool success = std::fwrite(&hdr, sizeof hdr, 1, file) == 1;
+        success &= std::fwrite(name_table.data(), sizeof(str), name_table.size(), file) == name_table.size();
+        success &= std::fwrite(keys.data(), sizeof(std::uint32_t), keys.size(), file) == keys.size();
+        success &= std::fwrite(offsets.data(), sizeof(std::uint32_t), offsets.size(), file) == offsets.size();
+        success &= std::fwrite(edges.data(), sizeof(std::uint32_t), edges.size(), file) == edges.size();
+        success &= std::fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+        success &= std::fflush(file) == 0 && ::fsync(::fileno(file)) == 0;
+        success &= std::fclose(file) == 0;
+
+        if (!success || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+            printerr(color::ERROR, "Failed to write '{}'.", filename);
+            rm(tmpname);
+            return false;
+        }
+        if (!rm(log_filename(name)))
+            return false;
+
+        // Start over with the new snapshot.
+        db.snap.unmap();
+        db.overlay.clear();
+        db.legacy = false;
+        map_snapshot(name, db);
+        return true;
+    }
+    static bool commit_db(std::string_view name, database& db) {
+        if (db.pending.empty())
+            return true;
+
+        const auto filename = log_filename(name);
+        const int fd = ::open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            printerr(color::ERROR, "Failed to open '{}': {}.", filename, std::strerror(errno));
+            return false;
+        }
+
+        bool success = true;
+        std::string_view data = db.pending;
+        while (!data.empty()) {
+            const auto n = ::write(fd, data.data(), data.size());
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                success = false;
+                break;
             }
-            db[name] = conflicts;
+            data.remove_prefix(static_cast<std::size_t>(n));
         }
+        success &= ::fsync(fd) == 0;
+        xclose(fd);
 
-        std::fclose(file);
-        return db;
+        if (!success) {
+            printerr(color::ERROR, "Failed to write '{}': {}.", filename, std::strerror(errno));
+            return false;
+        }
+        db.pending.clear();
+
+        const auto log_size = file_size(filename);
+        if (db.legacy || (log_size > min_compact_size && log_size > file_size(db_filename(name))))
+            return compact_db(name, db);
+        return true;
+    }
+    static void changed(std::string_view name, database& db) {
+        if (open_transactions == 0)
+            commit_db(name, db);
     }
-    void write(std::string_view name, const quickdb& db) {
-        const auto filename = fmt::format("{}/{}.db", dbdir, name);
-        std::FILE* file = std::fopen(filename.c_str(), "w");
 
-        for (const auto& [n, v] : db) {
-            fmt::print(file, "{}:", n);
-            if (!v.empty()) {
-                auto it = v.begin();
-                fmt::print(file, "{}", *it);
-                for (++it; it != v.end(); ++it)
-                    fmt::print(file, ",{}", *it);
+    bool contains(std::string_view dbname, std::string_view key) {
+        const auto& db = get_db(dbname);
+        if (const auto it = db.overlay.find(key); it != db.overlay.end())
+            return it->second.has_value();
+        return db.snap.find_key(key).has_value();
+    }
+    std::vector<std::string_view> lookup(std::string_view dbname, std::string_view key) {
+        const auto& db = get_db(dbname);
+        std::vector<std::string_view> result{};
+        if (const auto it = db.overlay.find(key); it != db.overlay.end()) {
+            if (it->second.has_value())
+                result.assign(begin(it->second.value()), end(it->second.value()));
+            return result;
+        }
+
+        const auto& snap = db.snap;
+        if (const auto idx = snap.find_key(key); idx.has_value()) {
+            for (auto i = snap.offsets[idx.value()]; i < snap.offsets[idx.value() + 1]; ++i)
+                result.push_back(snap.name(snap.edges[i]));
+        }
+        return result;
+    }
+    std::vector<std::string> keys_containing(std::string_view dbname, std::string_view value) {
+        const auto& db = get_db(dbname);
+        const auto& snap = db.snap;
+        std::vector<std::string> result{};
+
+        if (const auto id = snap.find_name(value); id.has_value()) {
+            for (std::uint32_t i = 0; i < snap.num_keys; ++i) {
+                const auto key = snap.name(snap.keys[i]);
+                if (snap.has_edge(i, id.value()) && db.overlay.find(key) == db.overlay.end())
+                    result.emplace_back(key);
             }
-            fmt::print(file, "\n");
         }
+        for (const auto& [key, values] : db.overlay) {
+            if (values.has_value() && values->count(std::string{value}) != 0)
+                result.push_back(key);
+        }
+        std::sort(begin(result), end(result));
+        return result;
+    }
 
-        std::fclose(file);
+    quickdb read(std::string_view name) {
+        const auto& db = get_db(name);
+        const auto& snap = db.snap;
+        quickdb result{};
+        for (std::uint32_t i = 0; i < snap.num_keys; ++i) {
+            auto& values = result[std::string{snap.name(snap.keys[i])}];
+            for (auto e = snap.offsets[i]; e < snap.offsets[i + 1]; ++e)
+                values.emplace_hint(values.end(), snap.name(snap.edges[e]));
+        }
+        for (const auto& [key, values] : db.overlay) {
+            if (values.has_value()) {
+                result[key] = values.value();
+            } else {
+                result.erase(key);
+            }
+        }
+        return result;
+    }
+    void write(std::string_view name, const quickdb& data) {
+        auto& db = get_db(name);
+        const auto current = read(name);
+        for (const auto& [key, _] : current) {
+            if (data.count(key) == 0) {
+                fmt::format_to(std::back_inserter(db.pending), "-{}\n", key);
+                db.overlay[key] = std::nullopt;
+            }
+        }
+        for (const auto& [key, values] : data) {
+            const auto it = current.find(key);
+            if (it == current.end() || it->second != values) {
+                db.pending += '+';
+                format_record(db.pending, key, values);
+                db.overlay[key] = values;
+            }
+        }
+        changed(name, db);
     }
     void set(std::string_view dbname, const std::string& name, const std::set<std::string>& value) {
-        auto db = read(dbname);
-        db[name] = value;
-        write(dbname, db);
+        set(dbname, name, std::set<std::string>{value});
     }
     void set(std::string_view dbname, const std::string& name, std::set<std::string>&& value) {
-        auto db = read(dbname);
-        db[name] = std::move(value);
-        write(dbname, db);
+        auto& db = get_db(dbname);
+        db.pending += '+';
+        format_record(db.pending, name, value);
+        db.overlay[name] = std::move(value);
+        changed(dbname, db);
     }
     void remove(std::string_view dbname, const std::string& name) {
-        auto db = read(dbname);
-        db.erase(name);
-        write(dbname, db);
+        if (!contains(dbname, name))
+            return;
+        auto& db = get_db(dbname);
+        fmt::format_to(std::back_inserter(db.pending), "-{}\n", name);
+        db.overlay[name] = std::nullopt;
+        changed(dbname, db);
+    }
+    bool compact(std::string_view name) {
+        auto& db = get_db(name);
+        return commit_db(name, db) && compact_db(name, db);
+    }
+
+    transaction::transaction() {
+        ++open_transactions;
+    }
+    transaction::~transaction() {
+        if (active)
+            commit();
+    }
+    bool transaction::commit() {
+        if (!active)
+            return true;
+        active = false;
+        if (--open_transactions != 0)
+            return true;
+
+        bool success = true;
+        for (auto& [name, db] : databases)
+            success &= commit_db(name, db);
+        success &= localdb::flush();
+        success &= fileindex::flush();
+        return success;
+    }
+    bool in_transaction() {
+        return open_transactions != 0;
     }
 }
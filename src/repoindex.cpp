@@ -0,0 +1,259 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <map>
+#include "minipkg2.hpp"
+#include "repoindex.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::repoindex {
+    static constexpr char magic[8] = "MPKGIDX";
+    static constexpr std::uint32_t format_version = 2;
+
+    // On-disk layout: header, entries[count] (sorted by name), string data.
+    struct header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t count;
+        // Modification times of the files that influence the parsing (parse.bash, env.bash, minipkg2.conf).
+        std::int64_t env_mtime[3];
+    };
+    struct entry {
+        std::uint64_t name_off;
+        std::uint64_t record_off;
+        std::uint32_t name_len;
+        std::uint32_t record_len;
+        stamp st;
+    };
+    struct overlay_entry {
+        stamp st;
+        std::string record;
+    };
+
+    static bool             loaded  = false;
+    static bool             dirty   = false;
+    static void*            map     = nullptr;
+    static std::size_t      mapsize = 0;
+    static const entry*     entries = nullptr;
+    static std::uint32_t    count   = 0;
+    // Modifications since the index was loaded, std::nullopt marks a removed entry.
+    static std::map<std::string, std::optional<overlay_entry>, std::less<>> overlay{};
+
+    static std::string index_filename() {
+        return dbdir + "/repo.idx";
+    }
+    static std::int64_t mtime_of(const char* filename) {
+        struct ::stat st;
+        if (::stat(filename, &st) != 0)
+            return 0;
+        return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+    static void env_mtime(std::int64_t (&mtimes)[3]) {
+        mtimes[0] = mtime_of(parse_filename);
+        mtimes[1] = mtime_of(env_filename);
+        mtimes[2] = mtime_of(config_filename);
+    }
+    static std::string_view data_at(std::uint64_t off, std::uint32_t len) {
+        return { static_cast<const char*>(map) + off, len };
+    }
+    static void unload() {
+        if (map)
+            ::munmap(map, mapsize);
+        map = nullptr;
+        mapsize = 0;
+        entries = nullptr;
+        count = 0;
+    }
+    static void load() {
+        if (loaded)
+            return;
+        loaded = true;
+
+        static bool registered = false;
+        if (!registered) {
+            // Keep the entries that were added by parse_repo(name).
+            std::atexit([] { save(); });
+            registered = true;
+        }
+
+        const auto filename = index_filename();
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        struct ::stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(header)) {
+            xclose(fd);
+            return;
+        }
+
+        mapsize = static_cast<std::size_t>(st.st_size);
+        map = ::mmap(nullptr, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+        xclose(fd);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            mapsize = 0;
+            return;
+        }
+
+        const auto* hdr = static_cast<const header*>(map);
+        std::int64_t mtimes[3];
+        env_mtime(mtimes);
+        if (std::memcmp(hdr->magic, magic, sizeof magic) != 0
+            || hdr->version != format_version
+            || std::memcmp(hdr->env_mtime, mtimes, sizeof mtimes) != 0
+            || sizeof(header) + hdr->count * sizeof(entry) > mapsize) {
+            printerr(color::DEBUG, "Discarding outdated repo index '{}'.", filename);
+            unload();
+            dirty = true;
+            return;
+        }
+
+        entries = reinterpret_cast<const entry*>(hdr + 1);
+        count = hdr->count;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            const auto& e = entries[i];
+            if (e.name_off + e.name_len > mapsize || e.record_off + e.record_len > mapsize) {
+                printerr(color::WARN, "Repo index '{}' is corrupted.", filename);
+                unload();
+                dirty = true;
+                return;
+            }
+        }
+    }
+    static const entry* find(std::string_view name) {
+        const auto* end = entries + count;
+        const auto* it = std::lower_bound(entries, end, name, [](const entry& e, std::string_view n) {
+            return data_at(e.name_off, e.name_len) < n;
+        });
+        return it != end && data_at(it->name_off, it->name_len) == name ? it : nullptr;
+    }
+
+    std::optional<stamp> make_stamp(std::string_view name) {
+        const auto base = fmt::format("{}/{}", repodir, name);
+        struct ::stat st;
+        if (::stat((base + "/package.build").c_str(), &st) != 0)
+            return {};
+
+        stamp result{};
+        result.build_mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        result.build_size  = static_cast<std::uint64_t>(st.st_size);
+        result.files_mtime = mtime_of((base + "/files").c_str());
+        return result;
+    }
+    std::optional<std::string_view> lookup(std::string_view name, const stamp& st) {
+        load();
+        if (const auto it = overlay.find(name); it != overlay.end()) {
+            if (!it->second.has_value() || it->second->st != st)
+                return {};
+            return std::string_view{it->second->record};
+        }
+
+        const auto* e = find(name);
+        if (!e || e->st != st)
+            return {};
+        return data_at(e->record_off, e->record_len);
+    }
+    void store(std::string_view name, const stamp& st, std::string record) {
+        load();
+        overlay.insert_or_assign(std::string{name}, overlay_entry{st, std::move(record)});
+        dirty = true;
+    }
+    void invalidate(const std::vector<std::string>& names) {
+        load();
+        for (const auto& name : names) {
+            if (find(name) != nullptr || overlay.find(name) != overlay.end()) {
+                overlay.insert_or_assign(name, std::nullopt);
+                dirty = true;
+            }
+        }
+    }
+    void retain(const std::set<std::string>& names) {
+        load();
+        for (std::uint32_t i = 0; i < count; ++i) {
+            const auto name = data_at(entries[i].name_off, entries[i].name_len);
+            if (names.count(std::string{name}) == 0 && overlay.find(name) == overlay.end()) {
+                overlay.emplace(std::string{name}, std::nullopt);
+                dirty = true;
+            }
+        }
+        for (auto& [name, value] : overlay) {
+            if (value.has_value() && names.count(name) == 0) {
+                value.reset();
+                dirty = true;
+            }
+        }
+    }
+    bool save() {
+        if (!dirty)
+            return true;
+
+        // Merge the mapped entries with the overlay.
+        std::map<std::string_view, std::pair<stamp, std::string_view>> merged{};
+        for (std::uint32_t i = 0; i < count; ++i) {
+            const auto& e = entries[i];
+            merged.emplace(data_at(e.name_off, e.name_len), std::make_pair(e.st, data_at(e.record_off, e.record_len)));
+        }
+        for (const auto& [name, value] : overlay) {
+            if (value.has_value()) {
+                merged.insert_or_assign(name, std::make_pair(value->st, std::string_view{value->record}));
+            } else {
+                merged.erase(name);
+            }
+        }
+
+        header hdr{};
+        std::memcpy(hdr.magic, magic, sizeof magic);
+        hdr.version = format_version;
+        hdr.count = static_cast<std::uint32_t>(merged.size());
+        env_mtime(hdr.env_mtime);
+
+        std::vector<entry> table{};
+        std::string strings{};
+        std::uint64_t off = sizeof(header) + merged.size() * sizeof(entry);
+        for (const auto& [name, value] : merged) {
+            entry e{};
+            e.name_off   = off + strings.size();
+            e.name_len   = static_cast<std::uint32_t>(name.size());
+            strings += name;
+            e.record_off = off + strings.size();
+            e.record_len = static_cast<std::uint32_t>(value.second.size());
+            strings += value.second;
+            e.st = value.first;
+            table.push_back(e);
+        }
+
+        const auto filename = index_filename();
+        // Concurrent runs (e.g. `list` during `install`) must not write to the same temporary file.
+        const auto tmpname = fmt::format("{}.{}.tmp", filename, ::getpid());
+        std::FILE* file = std::fopen(tmpname.c_str(), "wb");
+        if (!file) {
+            printerr(color::DEBUG, "Cannot write repo index '{}'.", tmpname);
+            return false;
+        }
+        bool success = std::fwrite(&hdr, sizeof hdr, 1, file) == 1;
+        success &= std::fwrite(table.data(), sizeof(entry), table.size(), file) == table.size();
+        success &= std::fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+        success &= std::fclose(file) == 0;
+
+        if (!success || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+            printerr(color::WARN, "Failed to write repo index '{}'.", filename);
+            rm(tmpname);
+            return false;
+        }
+
+        // Start over with the new file.
+        overlay.clear();
+        unload();
+        loaded = false;
+        dirty = false;
+        return true;
+    }
+}
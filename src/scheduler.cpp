@@ -0,0 +1,418 @@
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include "scheduler.hpp"
+#include "print.hpp"
+
+namespace minipkg2::scheduler {
+    enum class state {
+        WAITING,
+        RUNNING,
+        FINISHED,
+        FAILED,
+        SKIPPED,
+    };
+
+    // The order in which ready tasks are started.
+    static std::vector<std::size_t> start_order(std::size_t num_tasks, const options& opts) {
+        std::vector<std::size_t> order(num_tasks);
+        for (std::size_t i = 0; i < num_tasks; ++i)
+            order[i] = i;
+        if (opts.priority.size() == num_tasks) {
+            std::stable_sort(begin(order), end(order), [&](std::size_t a, std::size_t b) {
+                return opts.priority[a] > opts.priority[b];
+            });
+        }
+        return order;
+    }
+    static std::vector<std::vector<std::size_t>> make_dependents(const std::vector<task>& tasks) {
+        std::vector<std::vector<std::size_t>> dependents(tasks.size());
+        for (std::size_t i = 0; i < tasks.size(); ++i) {
+            for (const auto w : tasks[i].waits)
+                dependents[w].push_back(i);
+        }
+        return dependents;
+    }
+
+    // The order in which tasks are fetched: by priority, but never before the tasks they wait for.
+    static std::vector<std::size_t> fetch_order(const std::vector<task>& tasks, const std::vector<std::size_t>& order) {
+        std::vector<std::size_t> result{};
+        std::vector<bool> added(tasks.size(), false);
+        while (result.size() < tasks.size()) {
+            const auto before = result.size();
+            for (const auto i : order) {
+                if (!added[i] && std::all_of(begin(tasks[i].waits), end(tasks[i].waits), [&](std::size_t w) { return added[w]; })) {
+                    added[i] = true;
+                    result.push_back(i);
+                    break;
+                }
+            }
+            // Cycles can't be fetched in a topological order.
+            if (result.size() == before) {
+                for (const auto i : order) {
+                    if (!added[i]) {
+                        added[i] = true;
+                        result.push_back(i);
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    bool run(const std::vector<task>& tasks, const options& opts,
+             const std::function<std::vector<bool>(const std::vector<std::size_t>&)>& fetch,
+             const std::function<bool(std::size_t, std::size_t)>& build,
+             const std::function<bool(std::size_t)>& finish) {
+        const std::size_t slots = opts.slots != 0 ? opts.slots : 1;
+        std::vector<state> states(tasks.size(), state::WAITING);
+        std::vector<std::size_t> remaining(tasks.size(), 0);
+        for (std::size_t i = 0; i < tasks.size(); ++i)
+            remaining[i] = tasks[i].waits.size();
+        const auto dependents = make_dependents(tasks);
+        const auto order = start_order(tasks.size(), opts);
+
+        // Completed builds and fetches are passed from the workers to the calling thread.
+        enum class event_kind { BUILT, FETCHED, FETCHER_DONE };
+        struct event {
+            event_kind kind;
+            std::size_t i;
+            bool success;
+        };
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<event> completed{};
+        std::vector<std::thread> threads(tasks.size());
+
+        std::size_t running = 0;
+        bool abort = false;
+
+        // Jobs given to the running tasks.
+        std::vector<std::size_t> allocated(tasks.size(), 0);
+        std::size_t jobs_in_use = 0;
+
+        // Fetching: `ahead` counts the fetched tasks that weren't started (or skipped) yet.
+        // These are shared with the fetcher thread (protected by `mtx`).
+        std::condition_variable fetch_cv;
+        std::size_t ahead = 0;
+        std::vector<bool> cancelled(tasks.size(), false);
+        bool stop_fetching = false;
+        // Only used by the calling thread.
+        std::vector<bool> fetched(tasks.size(), !fetch);
+        std::vector<bool> released(tasks.size(), false);
+        bool fetcher_running = false;
+        std::thread fetcher{};
+
+        const auto notify = [&](event e) {
+            std::lock_guard lock{mtx};
+            completed.push_back(e);
+            cv.notify_one();
+        };
+        if (fetch) {
+            fetcher_running = true;
+            fetcher = std::thread{[&, fetch_order = fetch_order(tasks, order)] {
+                const std::size_t prefetch = std::max<std::size_t>(opts.prefetch, 1);
+                std::size_t next = 0;
+                while (true) {
+                    // Everything that fits into the window is fetched at once.
+                    std::vector<std::size_t> batch{};
+                    {
+                        std::unique_lock lock{mtx};
+                        fetch_cv.wait(lock, [&] { return stop_fetching || ahead < prefetch; });
+                        if (stop_fetching)
+                            break;
+                        for (; next < fetch_order.size() && ahead < prefetch; ++next) {
+                            if (cancelled[fetch_order[next]])
+                                continue;
+                            ++ahead;
+                            batch.push_back(fetch_order[next]);
+                        }
+                    }
+                    if (batch.empty())
+                        break;
+
+                    std::vector<bool> results{};
+                    try {
+                        results = fetch(batch);
+                    } catch (const std::exception& e) {
+                        printerr(color::ERROR, "{}", e.what());
+                    }
+                    results.resize(batch.size(), false);
+                    for (std::size_t k = 0; k < batch.size(); ++k)
+                        notify(event{event_kind::FETCHED, batch[k], results[k]});
+                }
+                notify(event{event_kind::FETCHER_DONE, 0, true});
+            }};
+        }
+
+        // A fetched task no longer counts as ahead, once it was started or won't be started at all.
+        const auto release = [&](std::size_t i) {
+            if (!fetch || !fetched[i] || released[i])
+                return;
+            released[i] = true;
+            std::lock_guard lock{mtx};
+            --ahead;
+            fetch_cv.notify_one();
+        };
+        const auto stop_fetcher = [&] {
+            std::lock_guard lock{mtx};
+            stop_fetching = true;
+            fetch_cv.notify_one();
+        };
+
+        const auto start = [&](std::size_t i, std::size_t jobs) {
+            states[i] = state::RUNNING;
+            release(i);
+            ++running;
+            allocated[i] = jobs;
+            jobs_in_use += jobs;
+            threads[i] = std::thread{[&, i, jobs] {
+                bool success;
+                try {
+                    success = build(i, jobs);
+                } catch (const std::exception& e) {
+                    printerr(color::ERROR, "{}", e.what());
+                    success = false;
+                }
+                notify(event{event_kind::BUILT, i, success});
+            }};
+        };
+        // Mark everything that (transitively) waits for `i` as skipped.
+        const auto skip_dependents = [&](std::size_t i) {
+            std::vector<std::size_t> stack{i};
+            while (!stack.empty()) {
+                const auto j = stack.back();
+                stack.pop_back();
+                for (const auto d : dependents[j]) {
+                    if (states[d] == state::WAITING) {
+                        states[d] = state::SKIPPED;
+                        release(d);
+                        {
+                            std::lock_guard lock{mtx};
+                            cancelled[d] = true;
+                        }
+                        stack.push_back(d);
+                    }
+                }
+            }
+        };
+        const auto fail = [&](std::size_t i, bool success) {
+            // Builds that complete after an abort are not installed.
+            states[i] = success ? state::SKIPPED : state::FAILED;
+            release(i);
+            skip_dependents(i);
+            if (!opts.keep_going && !abort) {
+                abort = true;
+                stop_fetcher();
+                if (running != 0)
+                    printerr(color::WARN, "Waiting for {} running build(s) to finish...", running);
+            }
+        };
+
+        while (true) {
+            if (!abort) {
+                std::vector<std::size_t> batch{};
+                for (std::size_t k = 0; k < order.size() && running + batch.size() < slots; ++k) {
+                    const auto i = order[k];
+                    if (states[i] == state::WAITING && remaining[i] == 0 && fetched[i])
+                        batch.push_back(i);
+                }
+
+                // The tasks that start together share the jobs that are currently unused.
+                // A task keeps its jobs until it finishes, so no task gets more than its share of all jobs,
+                // unless it is known to use more and no other task is about to start.
+                std::vector<std::size_t> jobs(batch.size(), 0);
+                if (opts.jobs != 0 && !batch.empty()) {
+                    const std::size_t share = std::max<std::size_t>(opts.jobs / slots, 1);
+                    bool others_waiting = false, others_close = false;
+                    for (std::size_t i = 0; i < tasks.size(); ++i) {
+                        if (states[i] != state::WAITING || std::find(begin(batch), end(batch), i) != end(batch))
+                            continue;
+                        others_waiting = true;
+                        // Tasks that wait for the batch can't start before it finishes.
+                        others_close |= std::all_of(begin(tasks[i].waits), end(tasks[i].waits), [&](std::size_t w) {
+                            return states[w] == state::FINISHED || states[w] == state::RUNNING;
+                        });
+                    }
+
+                    std::vector<std::size_t> wanted{};
+                    for (const auto i : batch) {
+                        const auto known = opts.parallelism.size() == tasks.size() ? opts.parallelism[i] : 0;
+                        if (known != 0) {
+                            wanted.push_back(others_close ? std::min(known, share) : known);
+                        } else {
+                            // The last tasks may use everything.
+                            wanted.push_back(others_waiting ? share : 0);
+                        }
+                    }
+                    jobs = divide(wanted, jobs_in_use < opts.jobs ? opts.jobs - jobs_in_use : 0);
+                }
+                for (std::size_t k = 0; k < batch.size(); ++k)
+                    start(batch[k], jobs[k]);
+            }
+            // Nothing runs and nothing can become ready anymore: the rest waits for each other.
+            if (running == 0 && fetcher_running) {
+                const bool can_start = std::any_of(begin(order), end(order), [&](std::size_t i) {
+                    return states[i] == state::WAITING && remaining[i] == 0;
+                });
+                if (!can_start)
+                    stop_fetcher();
+            }
+            if (running == 0 && !fetcher_running)
+                break;
+
+            std::unique_lock lock{mtx};
+            cv.wait(lock, [&] { return !completed.empty(); });
+            const auto ev = completed.front();
+            completed.pop_front();
+            lock.unlock();
+
+            if (ev.kind == event_kind::FETCHER_DONE) {
+                fetcher.join();
+                fetcher_running = false;
+                continue;
+            }
+            const auto i = ev.i;
+            if (ev.kind == event_kind::FETCHED) {
+                fetched[i] = true;
+                if (!ev.success && states[i] == state::WAITING) {
+                    fail(i, false);
+                } else if (states[i] != state::WAITING) {
+                    release(i);
+                }
+                continue;
+            }
+
+            threads[i].join();
+            --running;
+            jobs_in_use -= allocated[i];
+
+            bool success = ev.success;
+            if (success && !abort) {
+                try {
+                    success = finish(i);
+                } catch (const std::exception& e) {
+                    printerr(color::ERROR, "{}", e.what());
+                    success = false;
+                }
+            }
+
+            if (success && !abort) {
+                states[i] = state::FINISHED;
+                for (const auto d : dependents[i])
+                    --remaining[d];
+            } else {
+                fail(i, success);
+            }
+        }
+
+        std::size_t num_failed = 0, num_skipped = 0, num_stuck = 0;
+        for (const auto st : states) {
+            num_failed += st == state::FAILED;
+            num_skipped += st == state::SKIPPED;
+            num_stuck += st == state::WAITING;
+        }
+        // Without a failure, tasks are only left waiting if they wait for each other.
+        if (num_failed == 0 && !abort && num_stuck != 0)
+            printerr(color::ERROR, "{} of {} package(s) could not be started, because they wait for each other.", num_stuck, tasks.size());
+        num_skipped += num_stuck;
+        if (num_failed != 0)
+            printerr(color::ERROR, "{} of {} package(s) failed, {} skipped.", num_failed, tasks.size(), num_skipped);
+        return num_failed == 0 && num_skipped == 0;
+    }
+
+    std::vector<double> critical_path(const std::vector<task>& tasks, const std::vector<double>& durations) {
+        const auto dependents = make_dependents(tasks);
+
+        // Visit every task after all of its dependents (iterative post-order DFS).
+        std::vector<double> length(tasks.size(), 0.0);
+        std::vector<bool> visited(tasks.size(), false);
+        std::vector<std::pair<std::size_t, std::size_t>> stack{};
+        for (std::size_t root = 0; root < tasks.size(); ++root) {
+            if (visited[root])
+                continue;
+            visited[root] = true;
+            stack.emplace_back(root, 0);
+            while (!stack.empty()) {
+                auto& [i, pos] = stack.back();
+                if (pos < dependents[i].size()) {
+                    const auto d = dependents[i][pos++];
+                    if (!visited[d]) {
+                        visited[d] = true;
+                        stack.emplace_back(d, 0);
+                    }
+                    continue;
+                }
+
+                double longest = 0.0;
+                for (const auto d : dependents[i])
+                    longest = std::max(longest, length[d]);
+                length[i] = durations[i] + longest;
+                stack.pop_back();
+            }
+        }
+        return length;
+    }
+
+    std::vector<std::size_t> divide(const std::vector<std::size_t>& wanted, std::size_t budget) {
+        // Hand out the jobs starting with the smallest demand, what isn't needed goes to the others.
+        std::vector<std::size_t> order(wanted.size());
+        for (std::size_t k = 0; k < order.size(); ++k)
+            order[k] = k;
+        const auto demand = [&](std::size_t k) { return wanted[k] != 0 ? wanted[k] : budget; };
+        std::stable_sort(begin(order), end(order), [&](std::size_t a, std::size_t b) {
+            return demand(a) < demand(b);
+        });
+
+        std::vector<std::size_t> result(wanted.size(), 1);
+        std::size_t left = budget;
+        for (std::size_t k = 0; k < order.size(); ++k) {
+            const auto share = left / (order.size() - k);
+            const auto n = std::max<std::size_t>(std::min(demand(order[k]), share), 1);
+            result[order[k]] = n;
+            left -= std::min(n, left);
+        }
+        return result;
+    }
+
+    std::vector<interval> simulate(const std::vector<task>& tasks, const options& opts, const std::vector<double>& durations) {
+        const std::size_t slots = opts.slots != 0 ? opts.slots : 1;
+        const auto dependents = make_dependents(tasks);
+        const auto order = start_order(tasks.size(), opts);
+
+        std::vector<interval> result(tasks.size(), interval{0.0, 0.0});
+        std::vector<std::size_t> remaining(tasks.size(), 0);
+        for (std::size_t i = 0; i < tasks.size(); ++i)
+            remaining[i] = tasks[i].waits.size();
+
+        std::vector<bool> started(tasks.size(), false);
+        std::vector<std::size_t> running{};
+        double now = 0.0;
+        while (true) {
+            for (std::size_t k = 0; k < order.size() && running.size() < slots; ++k) {
+                const auto i = order[k];
+                if (!started[i] && remaining[i] == 0) {
+                    started[i] = true;
+                    result[i] = interval{now, now + durations[i]};
+                    running.push_back(i);
+                }
+            }
+            if (running.empty())
+                break;
+
+            // Advance to the task that finishes first.
+            const auto it = std::min_element(begin(running), end(running), [&](std::size_t a, std::size_t b) {
+                return result[a].end < result[b].end;
+            });
+            const auto i = *it;
+            running.erase(it);
+            now = result[i].end;
+            for (const auto d : dependents[i])
+                --remaining[d];
+        }
+        return result;
+    }
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include "sha256.hpp"
+
+namespace minipkg2::sha256 {
+    static constexpr std::uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    static constexpr std::uint32_t rotr(std::uint32_t x, unsigned n) noexcept {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    context::context()
+        : state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+          length{0}, buffer{}, buffered{0} {}
+
+    void context::transform(const unsigned char* block) {
+        std::uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = static_cast<std::uint32_t>(block[4*i]) << 24 | static_cast<std::uint32_t>(block[4*i + 1]) << 16
+                 | static_cast<std::uint32_t>(block[4*i + 2]) << 8 | static_cast<std::uint32_t>(block[4*i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            const auto s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+            const auto s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+        auto a = state[0], b = state[1], c = state[2], d = state[3];
+        auto e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            const auto t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            const auto t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+    void context::update(const void* data, std::size_t size) {
+        auto p = static_cast<const unsigned char*>(data);
+        length += size;
+
+        if (buffered != 0) {
+            const auto n = std::min(size, sizeof buffer - buffered);
+            std::memcpy(buffer + buffered, p, n);
+            buffered += n;
+            p += n;
+            size -= n;
+            if (buffered < sizeof buffer)
+                return;
+            transform(buffer);
+            buffered = 0;
+        }
+        for (; size >= sizeof buffer; p += sizeof buffer, size -= sizeof buffer)
+            transform(p);
+        std::memcpy(buffer, p, size);
+        buffered = size;
+    }
+
+    std::string context::hex_digest() {
+        const std::uint64_t bits = length * 8;
+        const unsigned char pad = 0x80;
+        const unsigned char zero = 0x00;
+        update(&pad, 1);
+        while (buffered != 56)
+            update(&zero, 1);
+        unsigned char size[8];
+        for (int i = 0; i < 8; ++i)
+            size[i] = static_cast<unsigned char>(bits >> (56 - 8*i));
+        update(size, sizeof size);
+
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string hex(64, '0');
+        for (int i = 0; i < 32; ++i) {
+            const auto byte = static_cast<unsigned>(state[i / 4] >> (24 - 8 * (i % 4))) & 0xff;
+            hex[2*i]     = digits[byte >> 4];
+            hex[2*i + 1] = digits[byte & 0xf];
+        }
+        return hex;
+    }
+
+    std::optional<std::string> file(const std::string& filename) {
+        std::FILE* file = std::fopen(filename.c_str(), "rb");
+        if (!file)
+            return {};
+
+        context ctx{};
+        char buffer[65536];
+        std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof buffer, file)) != 0)
+            ctx.update(buffer, n);
+        const bool success = !std::ferror(file);
+        std::fclose(file);
+        if (!success)
+            return {};
+        return ctx.hex_digest();
+    }
+
+    bool is_valid(std::string_view str) {
+        if (str.size() != 64)
+            return false;
+        for (const char c : str) {
+            if (!(c >= '0' && c <= '9') && !(c >= 'a' && c <= 'f'))
+                return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,139 @@
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <optional>
+#include <cstdio>
+#include "sourcecache.hpp"
+#include "minipkg2.hpp"
+#include "sha256.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::sourcecache {
+    std::string path(std::string_view sha256) {
+        return fmt::format("{}/sources/{}/{}", cachedir, sha256.substr(0, 2), sha256);
+    }
+
+    bool contains(std::string_view sha256) {
+        return ::access(path(sha256).c_str(), F_OK) == 0;
+    }
+
+    // `dest` is described by a stamp, ".<file>.sha256" next to it: "<sha256> <size> <mtime>".
+    static std::string stamp_filename(const std::string& dest) {
+        const auto slash = dest.rfind('/');
+        return dest.substr(0, slash + 1) + '.' + dest.substr(slash + 1) + ".sha256";
+    }
+
+    static std::string make_stamp(std::string_view sha256, const struct ::stat& st) {
+        return fmt::format("{} {} {}.{:09}\n", sha256, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    }
+
+    static void write_stamp(std::string_view sha256, const std::string& dest) {
+        struct ::stat st;
+        if (::stat(dest.c_str(), &st) != 0 || !write_file(stamp_filename(dest), make_stamp(sha256, st)))
+            rm(stamp_filename(dest));
+    }
+
+    bool is_checked_out(std::string_view sha256, const std::string& dest) {
+        struct ::stat st;
+        if (::stat(dest.c_str(), &st) != 0)
+            return false;
+
+        std::string stamp{};
+        if (std::FILE* file = std::fopen(stamp_filename(dest).c_str(), "r")) {
+            char buffer[256];
+            const std::size_t n = std::fread(buffer, 1, sizeof buffer, file);
+            stamp.assign(buffer, n);
+            std::fclose(file);
+        }
+        return stamp == make_stamp(sha256, st);
+    }
+
+    // Create `dest` with the contents of `src`: reflink, hardlink or copy.
+    // A reflink is preferred, because a build can't change the store through it.
+    static bool clone_file(const std::string& src, const std::string& dest) {
+        const int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0)
+            return false;
+        int out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            ::close(in);
+            return false;
+        }
+
+        bool success = ::ioctl(out, FICLONE, in) == 0;
+        if (!success) {
+            ::close(out);
+            rm(dest);
+            if (::link(src.c_str(), dest.c_str()) == 0) {
+                ::close(in);
+                return true;
+            }
+            if ((out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+                ::close(in);
+                return false;
+            }
+
+            char buffer[65536];
+            ssize_t n;
+            success = true;
+            while (success && (n = ::read(in, buffer, sizeof buffer)) != 0) {
+                success = n > 0 && ::write(out, buffer, static_cast<std::size_t>(n)) == n;
+            }
+        }
+        ::close(in);
+        success &= ::close(out) == 0;
+        if (!success)
+            rm(dest);
+        return success;
+    }
+
+    bool checkout(std::string_view sha256, const std::string& dest) {
+        if (!mkparentdirs(dest, 0755))
+            return false;
+
+        // Builds run as root, so a build may have written through a hardlink into the store.
+        const auto src = path(sha256);
+        if (sha256::file(src) != std::optional<std::string>{sha256}) {
+            printerr(color::WARN, "Removing '{}' from the source cache, it doesn't match its checksum.", src);
+            rm(src);
+            return false;
+        }
+
+        // Replace the file atomically, a partial file must not appear at `dest`.
+        const auto tmpname = dest + ".tmp";
+        rm(tmpname);
+        rm(stamp_filename(dest));
+        if (!clone_file(src, tmpname))
+            return false;
+        if (std::rename(tmpname.c_str(), dest.c_str()) != 0) {
+            rm(tmpname);
+            return false;
+        }
+        write_stamp(sha256, dest);
+        return true;
+    }
+
+    bool add(const std::string& file, std::string_view sha256) {
+        write_stamp(sha256, file);
+        if (contains(sha256))
+            return true;
+
+        const auto dest = path(sha256);
+        const auto tmpname = dest + ".tmp";
+        if (!mkparentdirs(dest, 0755) || !clone_file(file, tmpname)) {
+            printerr(color::WARN, "Failed to add '{}' to the source cache.", file);
+            return false;
+        }
+        // The file may be shared with builds (hardlinks), which must not modify it.
+        // This doesn't stop root, so checkout() verifies the file.
+        ::chmod(tmpname.c_str(), 0444);
+        if (std::rename(tmpname.c_str(), dest.c_str()) != 0) {
+            rm(tmpname);
+            return false;
+        }
+        return true;
+    }
+}
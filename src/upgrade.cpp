@@ -0,0 +1,76 @@
+#include <unistd.h>
+#include <algorithm>
+#include <set>
+#include "minipkg2.hpp"
+#include "package.hpp"
+#include "upgrade.hpp"
+#include "version.hpp"
+#include "quickdb.hpp"
+#include "utils.hpp"
+#include "print.hpp"
+
+namespace minipkg2::upgrade {
+    static bool in_repo(std::string_view name) {
+        return ::access(fmt::format("{}/{}/package.build", repodir, name).c_str(), R_OK) == 0;
+    }
+
+    std::vector<candidate> find_upgradable(const std::vector<std::string>& names) {
+        const auto installed = names.empty() ? installed_package::parse_local() : installed_package::parse_local(names);
+
+        std::vector<std::string> repo_names{};
+        for (const auto& pkg : installed) {
+            if (in_repo(pkg.name))
+                repo_names.push_back(pkg.name);
+        }
+        const auto repo = source_package::parse_repo(repo_names);
+
+        // Both sets are sorted by name, so they can be compared in a single pass.
+        std::vector<candidate> result{};
+        auto it = repo.begin();
+        for (const auto& pkg : installed) {
+            while (it != repo.end() && it->name < pkg.name)
+                ++it;
+            if (it == repo.end())
+                break;
+            if (it->name != pkg.name)
+                continue;
+
+            if (version::make_key(it->version) > version::make_key(pkg.version))
+                result.push_back(candidate{pkg.name, pkg.version, it->version});
+        }
+        return result;
+    }
+
+    std::vector<std::string> reverse_dependencies(const std::vector<std::string>& names) {
+        std::set<std::string> seen(begin(names), end(names));
+        std::vector<std::string> level(begin(names), end(names));
+        std::vector<std::string> result{};
+
+        // Breadth-first, so that the packages of each level can be loaded at once.
+        while (!level.empty()) {
+            std::vector<std::string> next{};
+            for (const auto& pkg : installed_package::parse_local(level)) {
+                // Dependencies may name the package itself or anything it provides.
+                std::vector<std::string_view> keys{pkg.name};
+                keys.insert(end(keys), begin(pkg.provides), end(pkg.provides));
+
+                for (const auto key : keys) {
+                    for (const auto rdep : quickdb::lookup("rdeps", key)) {
+                        std::string r{rdep};
+                        if (seen.insert(r).second)
+                            next.push_back(std::move(r));
+                    }
+                }
+            }
+
+            for (const auto& r : next) {
+                if (in_repo(r))
+                    result.push_back(r);
+            }
+            level = std::move(next);
+        }
+
+        std::sort(begin(result), end(result));
+        return result;
+    }
+}
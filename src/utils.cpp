@@ -19,6 +19,8 @@
 extern "C" char** environ;
 
 namespace minipkg2 {
+    std::atomic<std::size_t> spawn_count = 0;
+
     std::string xreadlink(const std::string& filename) {
         char buf[PATH_MAX + 1];
         const ssize_t n = ::readlink(filename.c_str(), buf, PATH_MAX);
@@ -31,6 +33,7 @@ namespace minipkg2 {
         FILE* file = ::popen(cmd.c_str(), "r");
         if (!file)
             throw std::runtime_error("popen('" + cmd + "') failed.");
+        ++spawn_count;
 
         std::string reply{};
 
@@ -135,7 +138,8 @@ namespace minipkg2 {
         return mkparentdirs(path, mode) && (mkdir(path.c_str(), mode) == 0 || errno == EEXIST);
     }
     void xpipe(int pipefd[2]) {
-        if (::pipe(pipefd) != 0)
+        // Close-on-exec, so that concurrently spawned children don't hold on to each other's pipes.
+        if (::pipe2(pipefd, O_CLOEXEC) != 0)
             raise("Failed to create pipe.");
     }
     void xclose(int fd) {
@@ -181,6 +185,19 @@ namespace minipkg2 {
             raise("Process {} did not terminate.", pid);
         return WEXITSTATUS(wstatus);
     }
+    // Also get the resource usage of the process and its waited-for children.
+    int xwait(pid_t pid, struct ::rusage& usage) {
+        int wstatus;
+        if (::wait4(pid, &wstatus, 0, &usage) != pid)
+            raise("Failed to wait for process {}.", pid);
+        if (!WIFEXITED(wstatus))
+            raise("Process {} did not terminate.", pid);
+        return WEXITSTATUS(wstatus);
+    }
+    int xsystem(const std::string& cmd) {
+        ++spawn_count;
+        return std::system(cmd.c_str());
+    }
     void cat(FILE* out, const std::string& filename) {
         FILE* in = std::fopen(filename.c_str(), "r");
         if (!in)
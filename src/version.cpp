@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cctype>
+#include "version.hpp"
+
+namespace minipkg2::version {
+    // Segment tags, in the order in which they compare.
+    enum : char {
+        PRERELEASE  = 1,
+        END         = 2,
+        SNAPSHOT    = 3,
+        SUFFIX      = 4,
+        NUMBER      = 5,
+    };
+
+    static bool is_prerelease(std::string_view word) {
+        return word == "alpha" || word == "beta" || word == "pre" || word == "rc";
+    }
+    static bool is_snapshot(std::string_view word) {
+        return word == "git" || word == "svn" || word == "hg" || word == "bzr";
+    }
+
+    std::string make_key(std::string_view version) {
+        std::string key{};
+        key.reserve(version.size() + 8);
+
+        std::size_t i = 0;
+        while (i < version.size()) {
+            const auto ch = static_cast<unsigned char>(version[i]);
+            if (std::isdigit(ch)) {
+                // Numbers are prefixed by their length, so that a longer number is always greater.
+                while (i < version.size() && version[i] == '0')
+                    ++i;
+                const auto begin = i;
+                while (i < version.size() && std::isdigit(static_cast<unsigned char>(version[i])))
+                    ++i;
+                key += NUMBER;
+                key += static_cast<char>(std::min<std::size_t>(i - begin, 255));
+                key += version.substr(begin, i - begin);
+            } else if (std::isalpha(ch)) {
+                std::string word{};
+                while (i < version.size() && std::isalpha(static_cast<unsigned char>(version[i])))
+                    word += static_cast<char>(std::tolower(static_cast<unsigned char>(version[i++])));
+                if (is_snapshot(word)) {
+                    key += SNAPSHOT;
+                } else {
+                    // Other letters are patch levels, like 1.1.1w or 9.6p1.
+                    key += is_prerelease(word) ? PRERELEASE : SUFFIX;
+                    key += word;
+                    key += '\0';
+                }
+            } else {
+                ++i;
+            }
+        }
+        key += END;
+        return key;
+    }
+
+    int compare(std::string_view a, std::string_view b) {
+        return make_key(a).compare(make_key(b));
+    }
+}
@@ -0,0 +1,106 @@
+// Downloads of file:// URLs: partial files left behind by an interrupted run,
+// checksums and the source cache.
+//
+// Usage: test-download
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fmt/core.h>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include "minipkg2.hpp"
+#include "download.hpp"
+#include "sha256.hpp"
+#include "utils.hpp"
+
+using namespace minipkg2;
+
+static int num_failed = 0;
+
+static void check(bool condition, std::string_view what) {
+    fmt::print("{} {}\n", condition ? "ok  " : "FAIL", what);
+    num_failed += !condition;
+}
+
+static std::string read(const std::string& filename) {
+    std::string data{};
+    if (std::FILE* file = std::fopen(filename.c_str(), "rb")) {
+        char buffer[4096];
+        std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof buffer, file)) != 0)
+            data.append(buffer, n);
+        std::fclose(file);
+    }
+    return data;
+}
+
+static std::size_t fetch(const std::string& url, const std::string& dest, const std::string& sha256 = {}) {
+    std::vector<transfer> transfers{ { url, dest, sha256 } };
+    return download(transfers, download_policy::MISSING);
+}
+
+int main() {
+    char tmpdir[] = "/tmp/test-download.XXXXXX";
+    if (!::mkdtemp(tmpdir)) {
+        std::perror("mkdtemp()");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+    cachedir = dir + "/cache";
+
+    // The upstream file.
+    std::string content{};
+    for (int i = 0; i < 100000; ++i)
+        content += fmt::format("line {}\n", i);
+    const auto upstream = dir + "/upstream.tar";
+    write_file(upstream, content);
+    const auto url = "file://" + upstream;
+    const auto sum = sha256::file(upstream).value();
+
+    // A complete download is verified and added to the cache.
+    const auto dest = dir + "/src/file.tar";
+    check(fetch(url, dest, sum) == 0 && read(dest) == content, "download with checksum");
+    check(::access(fmt::format("{}/sources/{}/{}", cachedir, sum.substr(0, 2), sum).c_str(), F_OK) == 0, "file is added to the cache");
+
+    // A file that is unchanged since it was added isn't checked out again.
+    const bool stamped = ::access((dir + "/src/.file.tar.sha256").c_str(), F_OK) == 0;
+    struct ::stat before, after;
+    ::stat(dest.c_str(), &before);
+    check(stamped && fetch(url, dest, sum) == 0 && ::stat(dest.c_str(), &after) == 0
+            && before.st_ino == after.st_ino, "unchanged file is kept");
+
+    // A file in the store that was modified (by a build, through a hardlink) is removed from it.
+    const auto stored = fmt::format("{}/sources/{}/{}", cachedir, sum.substr(0, 2), sum);
+    ::chmod(stored.c_str(), 0644);
+    write_file(stored, "modified by a build\n");
+    const auto dest1 = dir + "/src/copy.tar";
+    check(fetch(url, dest1, sum) == 0 && read(dest1) == content, "corrupted cache entry isn't used");
+    check(read(stored) == content, "corrupted cache entry is replaced");
+
+    // A part without validators and without a checksum can't be checked, so it is discarded.
+    const auto dest2 = dir + "/src/unchecked.tar";
+    write_file(dir + "/src/.unchecked.tar.part", "stale data of another version\n");
+    check(fetch(url, dest2) == 0 && read(dest2) == content, "unvalidated part is not resumed");
+
+    // A part of the right file is resumed, if the checksum is known.
+    const auto dest3 = dir + "/src/resumed.tar";
+    write_file(dir + "/src/.resumed.tar.part", content.substr(0, content.size() / 3));
+    rm_rf(cachedir);
+    check(fetch(url, dest3, sum) == 0 && read(dest3) == content, "part is resumed with a known checksum");
+
+    // A part of another file is detected by the checksum and removed.
+    const auto dest4 = dir + "/src/wrong.tar";
+    write_file(dir + "/src/.wrong.tar.part", std::string(content.size() / 3, 'x'));
+    rm_rf(cachedir);
+    check(fetch(url, dest4, sum) == 1 && ::access(dest4.c_str(), F_OK) != 0, "wrong part fails the checksum");
+    check(::access((dir + "/src/.wrong.tar.part").c_str(), F_OK) != 0, "wrong part is removed");
+    check(fetch(url, dest4, sum) == 0 && read(dest4) == content, "next attempt starts over");
+
+    // A missing file fails without leaving anything behind.
+    const auto dest5 = dir + "/src/missing.tar";
+    check(fetch("file://" + dir + "/missing.tar", dest5) == 1, "missing file fails");
+    check(::access((dir + "/src/.missing.tar.part").c_str(), F_OK) != 0, "no part of a missing file");
+
+    rm_rf(dir);
+    return num_failed != 0;
+}
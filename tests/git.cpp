@@ -0,0 +1,92 @@
+// Git sources with file:// URLs: mirrors in the cache and shared clones of them.
+//
+// Usage: test-git
+#include <unistd.h>
+#include <fmt/core.h>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include "minipkg2.hpp"
+#include "git.hpp"
+#include "utils.hpp"
+
+using namespace minipkg2;
+
+static int num_failed = 0;
+
+static void check(bool condition, std::string_view what) {
+    fmt::print("{} {}\n", condition ? "ok  " : "FAIL", what);
+    num_failed += !condition;
+}
+
+static std::string read(const std::string& filename) {
+    std::string data{};
+    if (std::FILE* file = std::fopen(filename.c_str(), "rb")) {
+        char buffer[4096];
+        std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof buffer, file)) != 0)
+            data.append(buffer, n);
+        std::fclose(file);
+    }
+    return data;
+}
+
+// Run git in the upstream repository.
+static bool run_git(const std::string& repo, const std::string& args) {
+    return std::system(fmt::format("git -C '{}' -c user.name=test -c user.email=test@example.org {} >/dev/null 2>&1",
+                                   repo, args).c_str()) == 0;
+}
+
+int main() {
+    if (std::system("git --version >/dev/null 2>&1") != 0) {
+        fmt::print("git is not installed\n");
+        return 77;
+    }
+
+    char tmpdir[] = "/tmp/test-git.XXXXXX";
+    if (!::mkdtemp(tmpdir)) {
+        std::perror("mkdtemp()");
+        return 1;
+    }
+    const std::string dir = tmpdir;
+    cachedir = dir + "/cache";
+
+    // The upstream repository, with a second branch.
+    const auto upstream = dir + "/upstream";
+    mkparentdirs(upstream + "/file", 0755);
+    write_file(upstream + "/file", "version 1\n");
+    check(run_git(upstream, "init -b main") && run_git(upstream, "add file") && run_git(upstream, "commit -m 1")
+          && run_git(upstream, "branch dev"), "create upstream repository");
+
+    const auto src = git::parse_source("git+file://" + upstream + "#branch=dev");
+    check(src.has_value() && src->url == "file://" + upstream && src->branch == "dev", "parse source");
+    auto name = upstream.substr(1);
+    for (auto& c : name)
+        c = c == '/' ? '_' : c;
+    check(git::mirror_path(src->url) == cachedir + "/git/" + name + ".git", "mirror path");
+
+    // The mirror is created and the branch is checked out from it.
+    const auto dest = dir + "/src/upstream";
+    check(git::update_mirror(src.value()), "create mirror");
+    check(::access((git::mirror_path(src->url) + "/HEAD").c_str(), F_OK) == 0, "mirror is a bare repository");
+    check(git::checkout_source(src.value(), dest) && read(dest + "/file") == "version 1\n", "checkout branch");
+    check(read(dest + "/.git/objects/info/alternates") == git::mirror_path(src->url) + "/objects\n", "checkout shares the objects of the mirror");
+
+    // Upstream changes are fetched into the mirror and replace the checkout.
+    write_file(upstream + "/file", "version 2\n");
+    check(run_git(upstream, "checkout dev") && run_git(upstream, "commit -a -m 2"), "change upstream branch");
+    write_file(dest + "/stale", "left behind by a build\n");
+    check(git::update_mirror(src.value()), "update mirror");
+    check(git::checkout_source(src.value(), dest) && read(dest + "/file") == "version 2\n", "checkout updated branch");
+    check(::access((dest + "/stale").c_str(), F_OK) != 0, "checkout replaces the old one");
+
+    // A shallow mirror only has the last commit.
+    const auto shallow = git::parse_source("git+file://" + upstream + "#branch=dev&depth=1");
+    rm_rf(cachedir);
+    check(shallow.has_value() && shallow->depth == 1 && git::update_mirror(shallow.value()), "create shallow mirror");
+    check(!run_git(git::mirror_path(shallow->url), "rev-parse --verify -q HEAD~1"), "shallow mirror has one commit");
+    check(git::checkout_source(shallow.value(), dest) && read(dest + "/file") == "version 2\n", "checkout shallow mirror");
+
+    rm_rf(dir);
+    return num_failed != 0;
+}
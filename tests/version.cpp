@@ -0,0 +1,78 @@
+// Comparison of package versions.
+//
+// Usage: test-version
+#include <fmt/core.h>
+#include <string_view>
+#include "version.hpp"
+
+using namespace minipkg2;
+
+struct test_case {
+    std::string_view a;
+    std::string_view b;
+    int expected;       // The sign of compare(a, b).
+};
+
+static const test_case cases[] = {
+    // Numbers are compared by value, not by width.
+    { "1.10",               "1.9",              1 },
+    { "1.2",                "1.10",             -1 },
+    { "10",                 "9",                1 },
+    { "1.0.1",              "1.0",              1 },
+    { "2.0",                "1.99.99",          1 },
+    { "20240101",           "20231231",         1 },
+
+    // Leading zeros and separators don't matter.
+    { "1.01",               "1.1",              0 },
+    { "1.001",              "1.1",              0 },
+    { "1.0",                "1.00",             0 },
+    { "1_2",                "1.2",              0 },
+    { "1.2",                "1.2",              0 },
+
+    // Pre-releases come before the release.
+    { "1.0alpha",           "1.0",              -1 },
+    { "1.0beta2",           "1.0",              -1 },
+    { "1.0pre1",            "1.0",              -1 },
+    { "1.0rc1",             "1.0",              -1 },
+    { "1.0-rc2",            "1.0rc1",           1 },
+    { "1.0alpha",           "1.0beta",          -1 },
+    { "1.0beta",            "1.0rc1",           -1 },
+    { "1.0RC1",             "1.0rc1",           0 },
+    { "1.0rc1",             "0.9",              1 },
+
+    // Other letters are patch levels after the release.
+    { "1.1.1w",             "1.1.1",            1 },
+    { "1.1.1w",             "1.1.1v",           1 },
+    { "1.1.1w",             "1.1.2",            -1 },
+    { "9.6p1",              "9.6",              1 },
+    { "9.6p2",              "9.6p1",            1 },
+    { "9.6p1",              "9.7",              -1 },
+    { "1.0a",               "1.0rc1",           1 },
+    { "1.0a",               "1.0p1",            -1 },
+    { "1.0a",               "1.0-git20240101",  1 },
+
+    // Snapshots come after the release, but before the next one.
+    { "1.0-git",            "1.0",              1 },
+    { "1.0-git20240101",    "1.0-git",          1 },
+    { "1.0-git20240102",    "1.0-git20240101",  1 },
+    { "1.0-git20240101",    "1.0.1",            -1 },
+    { "1.0-svn",            "1.0-git",          0 },
+    { "1.0-git",            "1.0rc1",           1 },
+};
+
+static int sign(int n) {
+    return (n > 0) - (n < 0);
+}
+
+int main() {
+    int num_failed = 0;
+    for (const auto& c : cases) {
+        // Both directions, the comparison must be antisymmetric.
+        const int forward = sign(version::compare(c.a, c.b));
+        const int backward = sign(version::compare(c.b, c.a));
+        const bool ok = forward == c.expected && backward == -c.expected;
+        fmt::print("{} compare({}, {}) = {}\n", ok ? "ok  " : "FAIL", c.a, c.b, forward);
+        num_failed += !ok;
+    }
+    return num_failed != 0;
+}
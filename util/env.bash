@@ -5,8 +5,13 @@
 __MINIPKG2_ENV=1
 
 # Load the minipkg2 config.
+# minipkg2 passes it as an open file descriptor, so it doesn't need to be executed again.
 declare -A config
-eval "$("$MINIPKG2" --root="$ROOT" config --dump 2>/dev/null)"
+if [[ $MINIPKG2_CONFIG_FD && -r /dev/fd/$MINIPKG2_CONFIG_FD ]]; then
+   source "/dev/fd/$MINIPKG2_CONFIG_FD"
+else
+   eval "$("$MINIPKG2" --root="$ROOT" config --dump 2>/dev/null)"
+fi
 
 
 # The $JOBS variable determines the amount of parallel workers per package.
@@ -21,7 +26,32 @@ fi
 
 shopt -s expand_aliases
 
-alias pmake="make -j '$JOBS'"
+# If minipkg2 runs a jobserver (MAKEFLAGS), the jobs are shared with all other builds.
+if [[ $MAKEFLAGS =~ --jobserver-auth=([0-9]+),([0-9]+) ]]; then
+   __MINIPKG2_JOBSERVER=("${BASH_REMATCH[1]}" "${BASH_REMATCH[2]}")
+   alias pmake="make"
+else
+   alias pmake="make -j '$JOBS'"
+fi
+
+# ninja can't use the jobserver, so take as many tokens as are available right now
+# and give them back when ninja has finished.
+pninja() {
+   local tokens tok ec
+   if [[ -z $__MINIPKG2_JOBSERVER ]]; then
+      ninja -j "$JOBS" "$@"
+      return
+   fi
+
+   tokens=
+   while (( ${#tokens} + 1 < JOBS )) && IFS= read -r -N1 -t 0.01 -u "${__MINIPKG2_JOBSERVER[0]}" tok; do
+      tokens+="$tok"
+   done
+   ninja -j "$(( ${#tokens} + 1 ))" "$@"
+   ec=$?
+   printf '%s' "$tokens" >&"${__MINIPKG2_JOBSERVER[1]}"
+   return "$ec"
+}
 
 
 # This must be called from minipkg2:pkg_build() after package()
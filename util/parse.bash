@@ -3,38 +3,76 @@
 # Include the env file.
 [[ -f $ENV_FILE ]] && source "$ENV_FILE"
 
+# Check the package, before it is printed.
+check_package() {
+   if (( ${#sha256sums[@]} != 0 && ${#sha256sums[@]} != ${#sources[@]} )); then
+      echo "$1: There are ${#sources[@]} sources, but ${#sha256sums[@]} sha256sums." >&2
+      return 1
+   fi
+   for sum in "${sha256sums[@]}"; do
+      if [[ $sum != SKIP && ! $sum =~ ^[0-9a-f]{64}$ ]]; then
+         echo "$1: Invalid SHA-256 sum '$sum'." >&2
+         return 1
+      fi
+   done
+}
+
+# Print the package.
+print_package() {
+   echo "$pkgname"
+   echo "$pkgver"
+   echo "$url"
+   echo "$description"
+   for src in "${sources[@]}"; do
+      echo "$src"
+   done
+   echo --
+   for sum in "${sha256sums[@]}"; do
+      echo "$sum"
+   done
+   echo --
+   for pkg in "${depends[@]}" "${bdepends[@]}"; do
+      echo "$pkg"
+   done
+   echo --
+   for pkg in "${depends[@]}" "${rdepends[@]}"; do
+      echo "$pkg"
+   done
+   echo --
+   for pkg in "${provides[@]}"; do
+      echo "$pkg"
+   done
+   echo --
+   for pkg in "${provides[@]}" "${conflicts[@]}"; do
+      echo "$pkg"
+   done
+   echo --
+   for feature in "${features[@]}"; do
+      echo "$feature"
+   done
+   echo --
+   echo "$build_date"
+   echo "$install_date"
+   echo "$install_reason"
+}
+
+# Server mode: read one filename per line from stdin,
+# and reply with the package followed by '\x1e<exit code> <number of lines>' and the lines printed to stderr.
+if [[ $1 = --server ]]; then
+   exec 3>&1
+   while IFS= read -r __file; do
+      __err=$( exec 2>&1 >&3 </dev/null; set -- "$__file"; source "$__file"; check_package "$__file" || exit 1; print_package; exit 0 )
+      __status=$?
+      __lines=${__err//[!$'\n']/}
+      printf '\x1e%d %d\n' "$__status" "$(( ${#__err} != 0 ? ${#__lines} + 1 : 0 ))"
+      [[ -n $__err ]] && printf '%s\n' "$__err"
+   done
+   exit 0
+fi
+
 # Let bash parse the package.
 source "$1"
 
-# Print the package.
-echo "$pkgname"
-echo "$pkgver"
-echo "$url"
-echo "$description"
-for src in "${sources[@]}"; do
-   echo "$src"
-done
-echo --
-for pkg in "${depends[@]}" "${bdepends[@]}"; do
-   echo "$pkg"
-done
-echo --
-for pkg in "${depends[@]}" "${rdepends[@]}"; do
-   echo "$pkg"
-done
-echo --
-for pkg in "${provides[@]}"; do
-   echo "$pkg"
-done
-echo --
-for pkg in "${provides[@]}" "${conflicts[@]}"; do
-   echo "$pkg"
-done
-echo --
-for feature in "${features[@]}"; do
-   echo "$feature"
-done
-echo --
-echo "$build_date"
-echo "$install_date"
+check_package "$1" || exit 1
+print_package
 exit 0